@@ -92,6 +92,11 @@ class UdaPluginSH extends UdaPlugin {
 	
 	public void removeJob( JobID jobId){
 		userRsrc.remove(jobId.toString());
+
+		// let C++ drop the cached index records of the job
+		List<String> params = new ArrayList<String>();
+		params.add(jobId.toString());
+		UdaBridge.doCommand(UdaCmd.formCmd(UdaCmd.JOB_OVER_COMMAND, params));
 	}
 	
 	
@@ -11,9 +11,9 @@ using namespace std;
 #include "ReaderFactory.h"
 
 
-AbstractReader* AbstractReader::create(string type, AbstractReader::Subscriber* subscriber)
+AbstractReader* AbstractReader::create(string type, AbstractReader::Subscriber* subscriber, int max_reads)
 {
-	return ReaderFactory::createReader(type, subscriber);
+	return ReaderFactory::createReader(type, subscriber, max_reads);
 }
 
 
@@ -19,15 +19,16 @@ public:
 		virtual ~Subscriber() {};
 		virtual int hasFreeBuffer() = 0;
 		virtual ReadCallbackArg* prepareRead(ReadRequest* req , bool shouldUseOsCache) = 0;
-		virtual int readCallback(ReadCallbackArg* data, int status) = 0;
+		virtual int readCallback(ReadCallbackArg* data, int status) = 0; // status is 0 iff all the requested length was read
 	};
 	//-------------------------------
 
 
-	static          AbstractReader* create(std::string type, Subscriber* subscriber); // factory method
+	// factory method - type is "aio" or "blocked", max_reads bounds the reads in flight at once
+	static          AbstractReader* create(std::string type, Subscriber* subscriber, int max_reads);
 	virtual 		~AbstractReader() {};
 	virtual int 	start() = 0;
-	virtual void 	insert(ReadRequest* req) = 0;
+	virtual void 	insert(ReadRequest* req) = 0; // takes req - readCallback gets an arg that the reader owns
 	virtual int 	submit() = 0;
 	virtual void 	stop() = 0;
 };
@@ -40,7 +41,7 @@ public:
 
 	// this CTOR expects to get buff and fd later (a la "lazy evaluation") using call to subscriber->prepareRead
 	ReadRequest(const std::string & _path, int64_t _offset, int64_t _length, void *_opaque = NULL) :
-		path(_path), fd (0), offset(_offset), length(_length), buff(NULL), opaque(_opaque) {}
+		path(_path), fd (-1), offset(_offset), length(_length), buff(NULL), opaque(_opaque) {}
 
 	// this CTOR is for the case that buff or fd are already known
 	ReadRequest(const std::string & _path, int64_t _offset, int64_t _length, int _fd, void *_buff = NULL, void *_opaque = NULL) :
@@ -49,7 +50,7 @@ public:
 public: // use const for public data members and avoid getters/setters
 
     const std::string path;		  // path to file this is only for telling us the right disk --- TODO: consider ref &
-	const int         fd;         // in case fd is 0 => we'll need to use 'prepareRead'
+	const int         fd;         // in case fd is -1 => we'll need to use 'prepareRead' (0 is a valid fd)
     const int64_t     offset;     // Offset in the file
     const int64_t     length;     // needed length for reading
     void * const      buff;       // in case buff is NULL => we'll need to use 'prepareRead'
@@ -0,0 +1,72 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+** either express or implied. See the License for the specific language
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#include "AioReader.h"
+#include <IOUtility.h>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+AioReader::AioReader(AbstractReader::Subscriber* _subscriber, int max_reads) : subscriber(_subscriber)
+{
+	timespec timeout;
+	timeout.tv_nsec = AIOREADER_TIMEOUT_IN_NSEC;
+	timeout.tv_sec = 0;
+	log(lsDEBUG, "AIO: creating new AIOHandler with maxevents=%d , min_nr=%d, nr=%d timeout=%ds %lus", max_reads, AIOREADER_MIN_NR, AIOREADER_NR, timeout.tv_sec, timeout.tv_nsec);
+	aio = new AIOHandler(AioReader::completionHandler, max_reads, AIOREADER_MIN_NR, AIOREADER_NR, &timeout);
+}
+
+//------------------------------------------------------------------------------
+AioReader::~AioReader()
+{
+	delete aio;
+}
+
+//------------------------------------------------------------------------------
+int AioReader::start()
+{
+	return aio->start();
+}
+
+//------------------------------------------------------------------------------
+void AioReader::insert(ReadRequest* req)
+{
+	AioReadArg *arg = new AioReadArg(this, req);
+	if (aio->prepare_read(req->fd, req->offset, req->length, (char*)req->buff, arg)) {
+		log(lsERROR, "failed to prepare AIO read of %s: offset=%lld length=%lld", req->path.c_str(), (long long)req->offset, (long long)req->length);
+		subscriber->readCallback(&arg->arg, -1);
+		delete arg;
+	}
+	delete req;
+}
+
+//------------------------------------------------------------------------------
+int AioReader::submit()
+{
+	return aio->submit();
+}
+
+//------------------------------------------------------------------------------
+/* static */ int AioReader::completionHandler(void* data, int status)
+{
+	AioReadArg *arg = (AioReadArg*)data;
+	int rc = arg->reader->subscriber->readCallback(&arg->arg, status);
+	delete arg;
+	return rc;
+}
@@ -0,0 +1,56 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+** either express or implied. See the License for the specific language
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#ifndef AIOREADER_H_
+#define AIOREADER_H_
+
+#include "AbstractReader.h"
+#include "AIOHandler.h"
+
+#define AIOREADER_MIN_NR			(1)
+#define AIOREADER_NR				(50)
+#define AIOREADER_TIMEOUT_IN_NSEC	(300000000)
+
+// reads with libaio and O_DIRECT, so offset, length and buff of requests must be aligned to AIO_ALIGNMENT
+class AioReader : public AbstractReader {
+
+public:
+	AioReader(AbstractReader::Subscriber* _subscriber, int max_reads);
+	virtual ~AioReader();
+	int start();
+	void insert(ReadRequest* req); // takes the request
+	int submit();
+	void stop() {} // the AIO thread stops with the D'tor
+
+private:
+	// the AIO argument of a request, which knows its reader
+	class AioReadArg {
+	public:
+		AioReadArg(AioReader *_reader, const ReadRequest *req) : reader(_reader), arg(req) {}
+		AioReader * const     reader;
+		ReadCallbackArg       arg;
+	};
+
+	static int completionHandler(void* data, int status);
+
+	AbstractReader::Subscriber* subscriber;
+	AIOHandler*                 aio;
+};
+
+#endif /* AIOREADER_H_ */
@@ -9,19 +9,24 @@
 #include "../include/IOUtility.h"
 #include "../UdaBridge.h"
 #include <string.h>
+#include <algorithm>
 #include "AsyncReaderThread.h"
 
 using namespace std;
 
-AsyncReaderManager::AsyncReaderManager(AbstractReader::Subscriber* _subscriber) : subscriber(_subscriber){
+#define OTHER_DISK "" // for files that are not in mapred.local.dir
 
+AsyncReaderManager::AsyncReaderManager(AbstractReader::Subscriber* _subscriber) : subscriber(_subscriber), started(false), stopped(false) {
+
+	pthread_mutex_init(&lock, NULL);
 	list<string> disks;
-	unsigned int threadsPerDisk = atoi(UdaBridge_invoke_getConfData_callback ("mapred.uda.provider.blocked.threads.per.disk", "1").c_str());
+	unsigned int threadsPerDisk = max(1, atoi(UdaBridge_invoke_getConfData_callback ("mapred.uda.provider.blocked.threads.per.disk", "1").c_str()));
+	maxThreadsPerDisk = max((int)threadsPerDisk, atoi(UdaBridge_invoke_getConfData_callback ("mapred.uda.provider.blocked.threads.per.disk.max", "4").c_str()));
 	string data = UdaBridge_invoke_getConfData_callback ("mapred.local.dir", "");
-	char dirs[data.length()];
+	char dirs[data.length() + 1];
 	strcpy(dirs,data.c_str());
 
-	log(lsDEBUG, "AsyncReaderManager threads per disk= %d, disks= %s", threadsPerDisk, dirs);
+	log(lsDEBUG, "AsyncReaderManager threads per disk= %d (up to %d), disks= %s", threadsPerDisk, (int)maxThreadsPerDisk, dirs);
 
 	char * pch = strtok (dirs,",");
 	while (pch != NULL)
@@ -29,6 +34,7 @@ AsyncReaderManager::AsyncReaderManager(AbstractReader::Subscriber* _subscriber)
 		initDiskQueues(string(pch), threadsPerDisk);
 		pch = strtok (NULL, ",");
 	}
+	initDiskQueues(OTHER_DISK, 1);
 
 	//init(subscriber, disks, threadsPerDisk);
 }
@@ -69,6 +75,8 @@ void AsyncReaderManager::init(AbstractReader::Subscriber* subscriber, list<strin
 
 AsyncReaderManager::~AsyncReaderManager()
 {
+	stop();
+
 	//clean worker threads
 	 for (map<string,list<AsyncReaderThread *> >::iterator it=workers.begin(); it!=workers.end(); ++it)
 	 {
@@ -84,10 +92,13 @@ AsyncReaderManager::~AsyncReaderManager()
 		 DiskQueue* dq = it->second;
 		 delete dq;
 	 }
+	 pthread_mutex_destroy(&lock);
 }
 
 int AsyncReaderManager::start()
 {
+	 pthread_mutex_lock(&lock);
+	 started = true;
 	 for (map<string,list<AsyncReaderThread *> >::iterator it=workers.begin(); it!=workers.end(); ++it)
 	 {
 		 for (list<AsyncReaderThread*>::iterator it2=it->second.begin(); it2!=it->second.end(); ++it2)
@@ -95,6 +106,7 @@ int AsyncReaderManager::start()
 			 (*it2)->start();
 		 }
 	 }
+	 pthread_mutex_unlock(&lock);
 
 	return 0;
 }
@@ -107,6 +119,17 @@ void AsyncReaderManager::insert(ReadRequest* req)
 	DiskQueue* diskQueue = findDiskQueue(disk);
 	if (diskQueue)
 	{
+		pthread_mutex_lock(&lock);
+		list<AsyncReaderThread *> &diskWorkers = workers[disk];
+		if (++waitingReads[disk] > (int)diskWorkers.size() && diskWorkers.size() < maxThreadsPerDisk && started && !stopped)
+		{
+			log(lsDEBUG, "adding reader thread %d of disk %s", (int)diskWorkers.size() + 1, disk.c_str());
+			AsyncReaderThread *reader = new AsyncReaderThread(disk, this);
+			diskWorkers.push_back(reader);
+			reader->start();
+		}
+		pthread_mutex_unlock(&lock);
+
 		diskQueue->push(req);
 	}
 	else
@@ -135,32 +158,65 @@ int AsyncReaderManager::submit()
 }
 
 
+void AsyncReaderManager::popped(const string &diskName)
+{
+	pthread_mutex_lock(&lock);
+	--waitingReads[diskName];
+	pthread_mutex_unlock(&lock);
+}
+
 string AsyncReaderManager::getDiskFromPath(string path)
 {
 	size_t index;
 	for (map<string,DiskQueue*>::iterator it=diskNameMap.begin(); it!=diskNameMap.end(); ++it)
 	{
-		if((index = path.find(it->first)) != string::npos)
+		if(it->first != OTHER_DISK && (index = path.find(it->first)) != string::npos)
 		{
 			return it->first;
 		}
 	}
 
-	log(lsERROR, "mof disk not found!, %s", path.c_str());
+	log(lsDEBUG, "mof disk not found, reading it with the threads of other files: %s", path.c_str());
 
-	return "error";
+	return OTHER_DISK;
 }
 
 void AsyncReaderManager::stop()
 {
+	 pthread_mutex_lock(&lock);
+	 if (stopped || !started) {
+		 stopped = true;
+		 pthread_mutex_unlock(&lock);
+		 return;
+	 }
+	 stopped = true;
+	 pthread_mutex_unlock(&lock);
+
+	 // all threads are marked before any is woken up; otherwise a thread that is
+	 // not marked yet could consume the NULL of another and wait again
 	 for (map<string,list<AsyncReaderThread *> >::iterator it=workers.begin(); it!=workers.end(); ++it)
 	 {
-		 list<AsyncReaderThread*> diskReaders = it->second;
+		 list<AsyncReaderThread*> &diskReaders = it->second;
 		 for (list<AsyncReaderThread*>::iterator it2 = diskReaders.begin(); it2 != diskReaders.end(); ++it2)
 		 {
-			 AsyncReaderThread * reader = *it2;
-			 reader->stop();
+			 (*it2)->stop();
+		 }
+	 }
+
+	 for (map<string,list<AsyncReaderThread *> >::iterator it=workers.begin(); it!=workers.end(); ++it)
+	 {
+		 for (size_t i = 0; i < it->second.size(); ++i)
+		 {
+			 diskNameMap[it->first]->push(NULL); // wakes up one thread of the disk
 		 }
 	 }
 
+	 for (map<string,list<AsyncReaderThread *> >::iterator it=workers.begin(); it!=workers.end(); ++it)
+	 {
+		 list<AsyncReaderThread*> &diskReaders = it->second;
+		 for (list<AsyncReaderThread*>::iterator it2 = diskReaders.begin(); it2 != diskReaders.end(); ++it2)
+		 {
+			 pthread_join((*it2)->worker, NULL);
+		 }
+	 }
 }
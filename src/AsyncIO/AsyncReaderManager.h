@@ -26,6 +26,9 @@ public:
 	int submit();
 	void stop();
 
+	// a reader thread of the disk took a request from its queue
+	void popped(const std::string &diskName);
+
 	DiskQueue* findDiskQueue(const std::string &diskName) {
 		std::map<std::string,DiskQueue*>::iterator it = diskNameMap.find(diskName);
 		return (it != diskNameMap.end()) ? it->second : NULL;
@@ -39,6 +42,13 @@ private:
 
 	std::map<std::string,DiskQueue*> diskNameMap;
 	std::map<std::string,std::list<AsyncReaderThread *> > workers;
+
+	// a disk gets another thread while more of its requests wait than it has threads, up to maxThreadsPerDisk
+	size_t maxThreadsPerDisk;
+	std::map<std::string,int> waitingReads; // inserted and not popped yet
+	pthread_mutex_t lock; // of workers and waitingReads
+	bool started;
+	bool stopped;
 };
 
 #endif /* BLOCKEDREADERMANAGER_H_ */
@@ -3,6 +3,8 @@
  *
  */
 
+#include <errno.h>
+#include <unistd.h>
 #include "AsyncReaderThread.h"
 #include "AsyncReaderManager.h"
 #include <UdaUtil.h>
@@ -51,6 +53,8 @@ void* AsyncReaderThread::asyncReaderThread() {
 	for (ReadRequest *req  = NULL; !this->m_stop; ) {
 		log(lsTRACE, "%s is working",diskName.c_str());
 		queueData->wait_and_pop(req); // wait for new requests
+		if (!req) continue; // woken up by stop
+		manager->popped(diskName);
 		processShuffleRequest(req);
 	}
 	return 0;
@@ -65,17 +69,37 @@ void AsyncReaderThread::processShuffleRequest(ReadRequest* req)
 	ReadCallbackArg _arg(req->fd, req->buff, req->opaque);
 	ReadCallbackArg* arg = &_arg;
 
-	if (req->buff == NULL || req->fd == 0) {
+	if (req->buff == NULL || req->fd < 0) {
 		arg = manager->subscriber->prepareRead(req, true);
 		if (!arg)
 		{
 			log(lsERROR, "prepareRead failed");
+			manager->subscriber->readCallback(&_arg, -1); // lets the subscriber release what it holds for the request
 			delete req;
 			return;
 		}
 	}
 
-	uint64_t size = pread(arg->fd, arg->buff, req->length, req->offset);
-	log(lsTRACE, "after read, readLength = %d, size read = %d",req->length, size);
-	manager->subscriber->readCallback(arg, 0);
+	int status = 0;
+	int64_t size = 0;
+	while (size < req->length) {
+		ssize_t rc = pread(arg->fd, (char*)arg->buff + size, req->length - size, req->offset + size);
+		if (rc < 0) {
+			if (errno == EINTR) continue;
+			status = errno;
+			log(lsERROR, "pread of %s failed: offset=%lld length=%lld (errno=%m)", req->path.c_str(), (long long)(req->offset + size), (long long)(req->length - size));
+			break;
+		}
+		if (rc == 0) {
+			status = -1;
+			log(lsERROR, "short read of %s: offset=%lld length=%lld but only %lld bytes", req->path.c_str(), (long long)req->offset, (long long)req->length, (long long)size);
+			break;
+		}
+		size += rc;
+	}
+	log(lsTRACE, "after read, readLength = %lld, size read = %lld", (long long)req->length, (long long)size);
+	manager->subscriber->readCallback(arg, status);
+
+	if (arg != &_arg) delete arg;
+	delete req;
 }
@@ -31,7 +31,7 @@ class AsyncReaderThread {
 public:
 	AsyncReaderThread(std::string _diskName, AsyncReaderManager* _manager);
 	void start();
-	void stop() {m_stop = true;}
+	void stop() {m_stop = true;} // the thread exits on the next NULL request of its queue
 	static void* asyncReaderThread(void*); //thread start
 
 	pthread_t  worker;
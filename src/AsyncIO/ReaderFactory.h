@@ -12,23 +12,22 @@
 #include "AbstractReader.h"
 #include "AIOHandler.h"
 #include "AsyncReaderManager.h"
+#include "AioReader.h"
 #include <UdaUtil.h>
 
 class ReaderFactory {
 public:
 
-	static AbstractReader* createReader(std::string type, AbstractReader::Subscriber* subscriber)
+	static AbstractReader* createReader(std::string type, AbstractReader::Subscriber* subscriber, int max_reads)
 	{
 		if(type.compare("blocked") == 0)
 		{
 			return (new AsyncReaderManager(subscriber));
 		}
-/*
 		else if(type.compare("aio") == 0)
 		{
-			return (new AIOHandler(subscriber));
+			return (new AioReader(subscriber, max_reads));
 		}
-//*/
 		else
 		{
 			throw new UdaException("unsupported read mode");
@@ -200,18 +200,24 @@ void AIOHandler::processEventsCallbacks()
 				cb = (iocb*)eventArr[i].obj;
 				aio_status = 0;
 				res=(long long)eventArr[i].res;
-				if (res < 0) {
+				if (cb->aio_lio_opcode == IO_CMD_PWRITE) {
+					// a write is never short, whatever the alignment; its writer handles the failure
+					aio_status = (res < 0) ? (int)res : (int)(cb->u.c.nbytes - res);
+					if (aio_status) {
+						log(lsERROR, "aio event: write failed. requested=%lu actual=%lld", (unsigned long)cb->u.c.nbytes, res);
+					}
+				}
+				// a failed read is passed to the callback as well, which releases its buffer
+				else if (res < 0) {
 					log(lsERROR,"aio event: completion with error, errno=%lld %m",res);
-					aio_status = 1;
-					throw new UdaException("aio event: completion with error");
+					aio_status = (int)res;
 				}
 				else if ((uint64_t)res != cb->u.c.nbytes ) { // res is the actual read/writen bytes  , u.c.nbytes is the requested bytes to read/write
 					if ((cb->u.c.nbytes - eventArr[i].res) > 2*AIO_ALIGNMENT) {
 						// if sub is less then 2*AIO_ALIGNMENT then it is probably as a reasult of alignment and EOF
 						// else , it is unexpected.
-						log(lsERROR, "aio event: unexpected number of bytes was read/written. requested=%lld actaul=%lld",cb->u.c.nbytes, res);
-						aio_status = 1;
-						throw new UdaException("aio event: unexpected number of bytes was read/written");
+						log(lsERROR, "aio event: unexpected number of bytes was read. requested=%lld actaul=%lld",cb->u.c.nbytes, res);
+						aio_status = (int)(cb->u.c.nbytes - res);
 					}
 				}
 
@@ -241,6 +247,7 @@ void AIOHandler::setCompletionCallback(AioCallback callback)
 	_callback=callback;
 	pthread_mutex_unlock(&_cbRowLock);
 }
+#endif
 
 int AIOHandler::prepare_write(int fd, uint64_t fileOffset, size_t sizeToWrite, char* srcBuffer, void* callback_arg)
 {
@@ -256,4 +263,3 @@ int AIOHandler::prepare_write(int fd, uint64_t fileOffset, size_t sizeToWrite, c
 
 	return 0;
 }
-#endif
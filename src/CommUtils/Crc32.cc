@@ -0,0 +1,90 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#include <pthread.h>
+#include <string.h>
+
+#include "Crc32.h"
+#include "IOUtility.h"
+
+#define CRC32_POLY 0xEDB88320U
+
+// slicing-by-8: crc_table[k][b] is the CRC of byte b followed by k zero bytes
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table()
+{
+	for (uint32_t b = 0; b < 256; ++b) {
+		uint32_t c = b;
+		for (int i = 0; i < 8; ++i) {
+			c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+		}
+		crc_table[0][b] = c;
+	}
+	for (uint32_t b = 0; b < 256; ++b) {
+		for (int k = 1; k < 8; ++k) {
+			uint32_t c = crc_table[k - 1][b];
+			crc_table[k][b] = (c >> 8) ^ crc_table[0][c & 0xff];
+		}
+	}
+}
+
+uint32_t crc32_update(uint32_t crc, const char *buf, int64_t len)
+{
+	if (len < 0) {
+		log(lsERROR, "negative length %lld for crc32", (long long)len);
+		throw new UdaException("negative length for crc32");
+	}
+	pthread_once(&crc_table_once, init_crc_table);
+
+	const unsigned char *p = (const unsigned char *)buf;
+	uint32_t c = ~crc;
+
+	for (; len && ((uintptr_t)p & 7); --len) {
+		c = (c >> 8) ^ crc_table[0][(c ^ *p++) & 0xff];
+	}
+	for (; len >= 8; len -= 8, p += 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= c;
+		c = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+			crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+			crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+			crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+	}
+	for (; len; --len) {
+		c = (c >> 8) ^ crc_table[0][(c ^ *p++) & 0xff];
+	}
+	return ~c;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
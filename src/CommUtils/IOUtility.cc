@@ -381,21 +381,6 @@ int StreamUtility::getVIntSize(int64_t i)
     return (dataBits + 7) / 8 + 1;
 }
 
-/**
- * Parse the first byte of a vint/vlong to determine the number of bytes
- * byteValue: value of the first byte of the vint/vlong
- * return the total number of bytes (1 to 9)
- */
-int StreamUtility::decodeVIntSize(int byteValue) {
-    if (byteValue >= -112)
-        return 1;
-    else if (byteValue < -120)
-        return -119 - byteValue;
-    else
-        return -111 - byteValue;
-}
-
-
 //------------------------------------------------------------------------------
 const char *rdmalog_dir = "default";
 static FILE *log_file = NULL;
@@ -490,6 +490,7 @@ void init_mem_desc(mem_desc_t *desc, char *addr, int32_t buf_len){
 	desc->status = INIT;
 	desc->start = 0;
 	desc->end = 0;
+	desc->rec_index = NULL;
 	pthread_mutex_init(&desc->lock, NULL);
 	pthread_cond_init(&desc->cond, NULL);
 }
@@ -106,7 +106,9 @@ static void server_comp_ibv_recv(netlev_wqe_t *wqe)
 		} else {
 			log(lsTRACE, "request as received by server: jobid=%s, map_id=%s, reduceID=%d, map_offset=%lld, qpnum=%d, offset=%lld, path=%s",data_req->m_jobid.c_str(), data_req->m_map.c_str(), data_req->reduceID, (long long)data_req->map_offset, conn->qp_hndl->qp_num, (long long)data_req->record->offset, data_req->record->path.c_str());
 			data_req->conn = conn;
+			pthread_mutex_lock(&conn->lock); // the engine's completion threads decrement it
 			conn->received_counter ++;
+			pthread_mutex_unlock(&conn->lock);
 
 			/* pass to parent and wake up other threads for processing */
 			log(lsTRACE, "server received RDMA fetch request: jobid=%s, map_id=%s, reduceID=%d, map_offset=%d",data_req->m_jobid.c_str(), data_req->m_map.c_str(), data_req->reduceID, data_req->map_offset);
@@ -149,6 +151,24 @@ static void delete_connection(struct netlev_ctx *ctx, struct netlev_conn *conn)
 	netlev_disconnect(conn);
 }
 
+/*
+ * Marks the connection as bad and deletes it if none of its requests is still
+ * in the engine; otherwise the completion of the last one deletes it (see
+ * rdma_write_mof_send_ack).  Both are decided under conn->lock, so exactly one
+ * caller deletes the connection.
+ */
+static void close_connection(struct netlev_ctx *ctx, struct netlev_conn *conn)
+{
+	pthread_mutex_lock(&conn->lock);
+	bool no_requests = !conn->bad_conn && !conn->received_counter;
+	conn->bad_conn = true;
+	pthread_mutex_unlock(&conn->lock);
+
+	if (no_requests) {
+		delete_connection(ctx, conn);
+	}
+}
+
 static void server_cq_handler(progress_event_t *pevent, void *data)
 {
 	int ne = 0;
@@ -185,8 +205,7 @@ static void server_cq_handler(progress_event_t *pevent, void *data)
 							netlev_stropcode(desc.opcode), desc.opcode, dev, ibv_wc_status_str(desc.status) ,desc.status, (uint64_t)desc.wr_id);
 					netlev_conn *conn = netlev_conn_find_by_qp((uint32_t) desc.qp_num, &dev->ctx->hdr_conn_list);
 					if (conn) {
-						conn->bad_conn = true;
-						delete_connection(dev->ctx, conn);
+						close_connection(dev->ctx, conn);
 					} else {
 						log(lsWARN, "After WC ERROR, can't find connection to clean. qp_num = %d",desc.qp_num);
 					}
@@ -330,9 +349,8 @@ static void server_cm_handler(progress_event_t *pevent, void *data)
 			if (ret) {
 				log(lsWARN, "ack cm event failed");
 			}
-			conn->bad_conn = true;
-			if (!conn->received_counter) {
-				delete_connection(ctx, conn);
+			if (conn) {
+				close_connection(ctx, conn);
 			}
 		}
 		// don't break here to avoid ack after disconnect
@@ -571,11 +589,12 @@ int RdmaServer::rdma_write_mof_send_ack(struct shuffle_req *req, uintptr_t laddr
 	    	log(lsERROR, "trying to send a message too big. msg_len=%d, max=%d",ack_msg_len, sizeof(h.msg));
 	    	throw new UdaException("trying to send a message too big");
 	}
+	// the engine's completion threads send concurrently, on the same connections;
+	// locking also prevents destruction of the connection before ibv_post_send
+	pthread_mutex_lock(&conn->lock);
 	conn->received_counter--;
 
 	if (!conn->bad_conn){
-		//locking to prevent destruction of the connection before ibv_post_send
-		pthread_mutex_lock(&conn->lock);
 		if (conn->credits>0){
 			log(lsTRACE, "before sending it is now %d, conn is %d in the send, h.msg is %s, rdma_send_size is %d", conn->received_counter, conn->bad_conn,h.msg,rdma_send_size);
 			init_wqe_rdmaw(&send_wr_rdma, &sge_rdma,
@@ -636,10 +655,13 @@ int RdmaServer::rdma_write_mof_send_ack(struct shuffle_req *req, uintptr_t laddr
 		}
 
 	} else {//connection does not exist anymore
+		bool last_request = !conn->received_counter;
+		pthread_mutex_unlock(&conn->lock);
+
 		log(lsERROR, "connection does not exist anymore. releasing chunk");
 		chunk_t *chunk_to_release = (chunk_t*) chunk;
 		state_mac.data_mac->release_chunk(chunk_to_release);
-		if (!conn->received_counter){
+		if (last_request){
 			log(lsINFO, "connection does not exist anymore, all related chunks are released. freeing connection");
 			delete_connection(&this->ctx, conn);
 		}
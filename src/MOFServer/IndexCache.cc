@@ -0,0 +1,211 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/mman.h>
+
+#include "IndexCache.h"
+#include "IOUtility.h"
+#include "Crc32.h"
+#include "UdaBridge.h"
+
+#define INDEX_ENTRY_LONGS     (3)  // startOffset, rawLength, partLength
+#define INDEX_CHECKSUM_LEN    (8)  // CRC32 of the entries, written as a long
+
+using namespace std;
+
+IndexCache::IndexCache(int64_t capacity) : capacity(capacity), used(0)
+{
+	pthread_mutex_init(&this->lock, NULL);
+}
+
+IndexCache::~IndexCache()
+{
+	for (index_iter it = indexes.begin(); it != indexes.end(); ++it) {
+		delete it->second;
+	}
+	pthread_mutex_destroy(&this->lock);
+}
+
+IndexCache* IndexCache::create()
+{
+	string value = UdaBridge_invoke_getConfData_callback("mapred.rdma.supplier.index.cache.bytes", INDEX_CACHE_BYTES);
+	int64_t capacity = atoll(value.c_str());
+	if (capacity <= 0) {
+		log(lsINFO, "index cache is disabled");
+		return NULL;
+	}
+	log(lsINFO, "index cache of %lld bytes", (long long)capacity);
+	return new IndexCache(capacity);
+}
+
+index_record_t* IndexCache::lookup(const string &jobid, const string &mapid, int reduceID)
+{
+	index_record_t *record = NULL;
+
+	pthread_mutex_lock(&this->lock);
+	index_iter it = indexes.find(jobid + ":" + mapid);
+	if (it != indexes.end()) {
+		spill_index_t *index = it->second;
+		size_t pos = (size_t)reduceID * INDEX_ENTRY_LONGS;
+		if (reduceID >= 0 && pos < index->entries.size()) {
+			record = new index_record_t();
+			record->offset = index->entries[pos];
+			record->rawLength = index->entries[pos + 1];
+			record->partLength = index->entries[pos + 2];
+			record->path = index->path;
+			lru.splice(lru.begin(), lru, index->lru_pos);
+		}
+		else {
+			log(lsWARN, "index cache: MOF %s has no partition for reduce %d", index->path.c_str(), reduceID);
+		}
+	}
+	pthread_mutex_unlock(&this->lock);
+
+	return record;
+}
+
+bool IndexCache::load(const string &jobid, const string &mapid, const string &mof_path)
+{
+	string key = jobid + ":" + mapid;
+
+	pthread_mutex_lock(&this->lock);
+	bool cached = indexes.find(key) != indexes.end();
+	pthread_mutex_unlock(&this->lock);
+	if (cached) return true;
+
+	// the file is read without the lock, another worker may load the same MOF meanwhile
+	spill_index_t *index = new spill_index_t();
+	if (!read_index_file(mof_path + ".index", index->entries)) {
+		delete index;
+		return false;
+	}
+	index->key = key;
+	index->jobid = jobid;
+	index->path = mof_path;
+	index->bytes = sizeof(spill_index_t) + index->entries.size() * sizeof(int64_t) + key.length() + mof_path.length();
+	if (index->bytes > capacity) {
+		delete index;
+		return false;
+	}
+
+	pthread_mutex_lock(&this->lock);
+	if (indexes.find(key) != indexes.end()) {
+		delete index;
+	}
+	else {
+		while (used + index->bytes > capacity) {
+			evict(lru.back());
+		}
+		indexes[key] = index;
+		index->lru_pos = lru.insert(lru.begin(), index);
+		used += index->bytes;
+	}
+	pthread_mutex_unlock(&this->lock);
+
+	return true;
+}
+
+// The MR1 plugin (UdaPluginTT) never sends JOB_OVER_MSG: Hadoop 1's ShuffleProviderPlugin
+// has no call when a job is over.  There, the MOFs of finished jobs stay cached until
+// they are the least recently used, so the cache is still bounded by its capacity.
+void IndexCache::remove_job(const string &jobid)
+{
+	string prefix = jobid + ":";
+	int removed = 0;
+
+	pthread_mutex_lock(&this->lock);
+	// keys are ordered, so the MOFs of the job are adjacent
+	index_iter it = indexes.lower_bound(prefix);
+	while (it != indexes.end() && it->first.compare(0, prefix.length(), prefix) == 0) {
+		spill_index_t *index = (it++)->second;
+		evict(index);
+		++removed;
+	}
+	pthread_mutex_unlock(&this->lock);
+
+	log(lsDEBUG, "index cache: removed %d MOFs of job %s", removed, jobid.c_str());
+}
+
+// called with the lock held
+void IndexCache::evict(spill_index_t *index)
+{
+	lru.erase(index->lru_pos);
+	indexes.erase(index->key);
+	used -= index->bytes;
+	delete index;
+}
+
+// file.out.index is Hadoop's SpillRecord: big endian <startOffset, rawLength, partLength>
+// per partition, followed by the CRC32 of these entries
+bool IndexCache::read_index_file(const string &index_path, vector<int64_t> &entries)
+{
+	int fd = open(index_path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		log(lsWARN, "index cache: cannot open %s (errno=%m)", index_path.c_str());
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= INDEX_CHECKSUM_LEN
+			|| (st.st_size - INDEX_CHECKSUM_LEN) % (INDEX_ENTRY_LONGS * sizeof(int64_t)) != 0) {
+		log(lsWARN, "index cache: %s is not a spill index", index_path.c_str());
+		close(fd);
+		return false;
+	}
+
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		log(lsWARN, "index cache: cannot mmap %s (errno=%m)", index_path.c_str());
+		return false;
+	}
+
+	const char *data = (const char*)addr;
+	int64_t entries_len = st.st_size - INDEX_CHECKSUM_LEN;
+	uint64_t checksum;
+	memcpy(&checksum, data + entries_len, sizeof(checksum));
+	bool valid = crc32_update(0, data, entries_len) == be64toh(checksum);
+	if (valid) {
+		entries.resize(entries_len / sizeof(int64_t));
+		memcpy(&entries[0], data, entries_len);
+		for (size_t i = 0; i < entries.size(); ++i) {
+			entries[i] = (int64_t)be64toh((uint64_t)entries[i]);
+		}
+	}
+	else {
+		log(lsWARN, "index cache: checksum error in %s", index_path.c_str());
+	}
+
+	munmap(addr, st.st_size);
+	return valid;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -0,0 +1,92 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#ifndef INDEX_CACHE_H
+#define INDEX_CACHE_H 1
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+
+#include "IndexInfo.h"
+
+#define INDEX_CACHE_BYTES "10485760" // as Hadoop's mapreduce.tasktracker.indexcache.mb
+
+/*
+ * Caches the spill index (file.out.index) of map outputs, keyed by job and map,
+ * so that only the first request for a MOF goes to java for its path.
+ * Every other reducer gets its <offset, rawLength, partLength> from memory.
+ * Least recently used MOFs are evicted above the configured size in bytes,
+ * and all the MOFs of a job are dropped when it is over (see remove_job).
+ */
+class IndexCache
+{
+public:
+    IndexCache(int64_t capacity);
+    ~IndexCache();
+
+    // NULL when disabled by mapred.rdma.supplier.index.cache.bytes = 0
+    static IndexCache* create();
+
+    // new record of the reducer's partition, or NULL if the MOF is not cached
+    index_record_t* lookup(const string &jobid, const string &mapid, int reduceID);
+
+    // parses <mof_path>.index of a MOF that java has just resolved
+    bool load(const string &jobid, const string &mapid, const string &mof_path);
+
+    // on JOB_OVER_MSG; only the YARN plugins send it (see IndexCache.cc)
+    void remove_job(const string &jobid);
+
+private:
+    typedef struct spill_index
+    {
+        string                    key;
+        string                    jobid;
+        string                    path;       // of the MOF
+        std::vector<int64_t>      entries;    // 3 per partition as in the file
+        int64_t                   bytes;      // charged to the cache
+        std::list<spill_index*>::iterator lru_pos;
+    } spill_index_t;
+
+    typedef std::map<string, spill_index_t*>::iterator index_iter;
+
+    pthread_mutex_t                   lock;
+    std::map<string, spill_index_t*>  indexes;
+    std::list<spill_index_t*>         lru; // front is the most recently used
+    int64_t                           capacity;
+    int64_t                           used;
+
+    static bool read_index_file(const string &index_path, std::vector<int64_t> &entries);
+    void evict(spill_index_t *index);
+};
+
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -21,11 +21,17 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
 
 #include "MOFServlet.h"
 #include "IOUtility.h"
 #include "IndexInfo.h"
+#include "IndexCache.h"
 #include "UdaBridge.h"
+#include "UdaUtil.h"
 
 using namespace std;
 
@@ -35,26 +41,55 @@ enum MEM_STAT {FREE, OCCUPIED, INUSE};
 
 DataEngine::DataEngine(void *mem,
                        supplier_state_t *state,
-                       const char *path, int mode, int rdma_buf_size, struct rlimit kernel_fd_rlim) : jniEnv(NULL)
+                       const char *path, int mode, int rdma_buf_size, struct rlimit kernel_fd_rlim) : _thread_id(0)
 {
-
-	prepare_tables(mem, rdma_buf_size);
-
     /* fast mapping from path to partition_table_t */
     this->state_mac = state;
     this->stop = false;
     this->rdma_buf_size = rdma_buf_size;
     this->_kernel_fd_rlim=kernel_fd_rlim;
-   
-    this->_fdc_map = new map<string, fd_counter_t*> ();
-    timespec timeout;
-    timeout.tv_nsec=AIOHANDLER_TIMEOUT_IN_NSEC;
-    timeout.tv_sec=0;
-	log(lsDEBUG, "AIO: creating new AIOHandler with maxevents=%d , min_nr=%d, nr=%d timeout=%ds %lus",AIOHANDLER_CTX_MAXEVENTS, AIOHANDLER_MIN_NR, AIOHANDLER_NR , timeout.tv_sec, timeout.tv_nsec );
-	_aioHandler = new AIOHandler(aio_completion_handler, AIOHANDLER_CTX_MAXEVENTS, AIOHANDLER_MIN_NR , AIOHANDLER_NR, &timeout );
-	_thread_id=0;
 
+    string value = UdaBridge_invoke_getConfData_callback("mapred.rdma.supplier.engine.threads", ENGINE_WORKERS);
+    int num_workers = max(1, min(atoi(value.c_str()), NETLEV_RDMA_MEM_CHUNKS_NUM));
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.supplier.engine.numa", "0");
+    this->bind_numa = atoi(value.c_str()) != 0;
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.supplier.coalesce.reads", "1");
+    this->coalesce_reads = atoi(value.c_str()) != 0;
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.supplier.disk.inflight", "0");
+    this->disk_in_flight = max(0, atoi(value.c_str()));
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.supplier.disk.batch.usec", "0");
+    this->disk_batch_usec = max(0, atoi(value.c_str()));
+    this->read_mode = UdaBridge_invoke_getConfData_callback("mapred.rdma.supplier.read.mode", "aio");
+    if (read_mode != "aio" && read_mode != "blocked") {
+        log(lsWARN, "DataEngine: unknown read mode %s - using aio", read_mode.c_str());
+        read_mode = "aio";
+    }
+    this->direct_io = (read_mode == "aio");
+
+    // a disk per local dir, as AsyncReaderManager
+    value = UdaBridge_invoke_getConfData_callback("mapred.local.dir", "");
+    char *dirs = strdup(value.c_str());
+    char *saveptr;
+    for (char *dir = strtok_r(dirs, ",", &saveptr); dir; dir = strtok_r(NULL, ",", &saveptr)) {
+        local_dirs.push_back(dir);
+    }
+    free(dirs);
+    log(lsINFO, "DataEngine: %s reads, %d disks, at most %d reads on a disk per worker, batching %d usec", read_mode.c_str(), (int)local_dirs.size(), disk_in_flight, disk_batch_usec);
+    this->index_cache = IndexCache::create();
+
+    for (int i = 0; i < num_workers; ++i) {
+        EngineWorker *worker;
+        if (num_workers == 1) { // consumes the mover's requests directly, as there is nothing to shard
+            worker = new EngineWorker(this, i, &state->mover->incoming_req_list, &state->mover->in_lock, &state->mover->in_cond);
+        }
+        else {
+            worker = new EngineWorker(this, i, NULL, NULL, NULL);
+        }
+        _workers.push_back(worker);
+    }
+    log(lsINFO, "DataEngine: %d worker threads", num_workers);
 
+	prepare_tables(mem, rdma_buf_size);
 }
 
 #if _BullseyeCoverage
@@ -63,32 +98,12 @@ DataEngine::DataEngine(void *mem,
 void
 DataEngine::cleanup_tables()
 {
-    pthread_mutex_lock(&_data_lock);
-    path_fd_iter iter = this->_fdc_map->begin();
-
-    while (iter != this->_fdc_map->end()) {
-		fd_counter_t* fdc = iter->second;
-		// TODO: cancel all aio operations before surprising the kernel with closed FDs to avoid writing ERROR logs entries by AIO thread
-		if(fdc){
-			if (fdc->fd)
-				close(fdc->fd);
-			delete fdc;
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        delete _workers[i];
     }
-		iter++;
-	}
-    delete(this->_fdc_map);
-
-    pthread_mutex_unlock(&_data_lock);
-
-
-    pthread_mutex_lock(&this->_chunk_mutex);
+    _workers.clear();
+    delete this->index_cache;
     free(this->_chunks);
-    pthread_mutex_unlock(&this->_chunk_mutex);
-
-
-    pthread_mutex_destroy(&this->_data_lock);
-    pthread_mutex_destroy(&this->_chunk_mutex);
-    pthread_cond_destroy(&this->_chunk_cond);
 }
 #if _BullseyeCoverage
 	#pragma BullseyeCoverage on
@@ -100,13 +115,6 @@ DataEngine::prepare_tables(void *mem,
 {
     char *data=(char*)mem;
 
-    pthread_mutex_init(&this->_data_lock, NULL);
-    pthread_mutex_init(&this->_chunk_mutex, NULL);
-    pthread_cond_init(&this->_chunk_cond, NULL);
-    INIT_LIST_HEAD(&this->_free_chunks_list);
-
-
-    pthread_mutex_lock(&this->_chunk_mutex);
     this->_chunks = (chunk_t*)malloc(NETLEV_RDMA_MEM_CHUNKS_NUM * sizeof(chunk_t));
     memset(this->_chunks , 0, NETLEV_RDMA_MEM_CHUNKS_NUM * sizeof(chunk_t));
 
@@ -115,10 +123,9 @@ DataEngine::prepare_tables(void *mem,
         chunk_t *ptr = this->_chunks + i;
         ptr->buff = data + i*(rdma_buf_size + 2*AIO_ALIGNMENT );
         ptr->type = PTR_CHUNK;
-        list_add_tail(&ptr->list, &this->_free_chunks_list);
+        ptr->refs = 1;
+        release_chunk(ptr);
     }
-    pthread_mutex_unlock(&this->_chunk_mutex);
-
 }
 
 #if _BullseyeCoverage
@@ -127,12 +134,38 @@ DataEngine::prepare_tables(void *mem,
 DataEngine::~DataEngine()
 {
     cleanup_tables();
-    delete _aioHandler;
 }
 #if _BullseyeCoverage
 	#pragma BullseyeCoverage on
 #endif
 
+void
+DataEngine::release_chunk(chunk_t* chunk) {
+	_workers[(chunk - _chunks) % _workers.size()]->release_chunk(chunk);
+}
+
+int
+DataEngine::disk_of(const string &path) {
+	for (size_t i = 0; i < local_dirs.size(); ++i) {
+		if (path.find(local_dirs[i]) != string::npos)
+			return i;
+	}
+	return local_dirs.size();
+}
+
+EngineWorker*
+DataEngine::worker_of(const shuffle_req_t *req) {
+	// FNV-1a of the job and map ids, which determine the MOF
+	uint32_t h = 2166136261U;
+	for (size_t i = 0; i < req->m_jobid.length(); ++i) {
+		h = (h ^ (unsigned char)req->m_jobid[i]) * 16777619U;
+	}
+	for (size_t i = 0; i < req->m_map.length(); ++i) {
+		h = (h ^ (unsigned char)req->m_map[i]) * 16777619U;
+	}
+	return _workers[h % _workers.size()];
+}
+
 /**
  * 1. DataEngine pops out requests from global queue 
  * 2. Check the cache
@@ -142,27 +175,204 @@ void
 DataEngine::start()
 {
 	_thread_id = pthread_self();
-	_aioHandler->start();
+
+	if (_workers.size() == 1) {
+		_workers[0]->run();
+	}
+	else {
+		for (size_t i = 0; i < _workers.size(); ++i) {
+			uda_thread_create(&_workers[i]->thread, NULL, EngineWorker::run_start, _workers[i]);
+		}
+		dispatch_requests();
+
+		for (size_t i = 0; i < _workers.size(); ++i) {
+			pthread_mutex_lock(&_workers[i]->own_req_lock);
+			pthread_cond_broadcast(&_workers[i]->own_req_cond);
+			pthread_mutex_unlock(&_workers[i]->own_req_lock);
+			pthread_join(_workers[i]->thread, NULL);
+		}
+	}
+
+    output_stdout("DataEngine stopped");
+}
+
+void
+DataEngine::dispatch_requests()
+{
+	OutputServer *mover = state_mac->mover;
+
+	// the workers do not take in_lock, so passing the requests under it is fine
+	pthread_mutex_lock(&mover->in_lock);
+	while (!this->stop) {
+		if (list_empty(&mover->incoming_req_list)) {
+			pthread_cond_wait(&mover->in_cond, &mover->in_lock);
+			continue;
+		}
+		shuffle_req_t *req = list_entry(mover->incoming_req_list.next, typeof(*req), list);
+		list_del(&req->list);
+		worker_of(req)->insert_req(req);
+	}
+	pthread_mutex_unlock(&mover->in_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+EngineWorker::EngineWorker(DataEngine *_engine, int _id,
+                           struct list_head *_req_list, pthread_mutex_t *_req_lock, pthread_cond_t *_req_cond) :
+	id(_id), thread(0), engine(_engine), jniEnv(NULL), _reschedule(false)
+{
+    pthread_mutex_init(&this->_data_lock, NULL);
+    pthread_mutex_init(&this->_chunk_mutex, NULL);
+    pthread_cond_init(&this->_chunk_cond, NULL);
+    INIT_LIST_HEAD(&this->_free_chunks_list);
+
+    INIT_LIST_HEAD(&this->own_req_list);
+    pthread_mutex_init(&this->own_req_lock, NULL);
+    pthread_cond_init(&this->own_req_cond, NULL);
+    this->req_list = _req_list ? _req_list : &this->own_req_list;
+    this->req_lock = _req_lock ? _req_lock : &this->own_req_lock;
+    this->req_cond = _req_cond ? _req_cond : &this->own_req_cond;
+
+    _disks.resize(engine->local_dirs.size() + 1); // and one for MOFs outside of them
+    for (size_t i = 0; i < _disks.size(); ++i) {
+        _disks[i].in_flight = 0;
+        _disks[i].last_offset = 0;
+    }
+
+    this->_fdc_map = new map<string, fd_counter_t*> ();
+	_reader = AbstractReader::create(engine->read_mode, this, AIOHANDLER_CTX_MAXEVENTS);
+}
+
+#if _BullseyeCoverage
+	#pragma BullseyeCoverage off
+#endif
+EngineWorker::~EngineWorker()
+{
+    delete _reader; // stops and joins its threads, whose completions use the fds and the chunks
+
+    pthread_mutex_lock(&_data_lock);
+    path_fd_iter iter = this->_fdc_map->begin();
+
+    while (iter != this->_fdc_map->end()) {
+		fd_counter_t* fdc = iter->second;
+		// TODO: cancel all aio operations before surprising the kernel with closed FDs to avoid writing ERROR logs entries by AIO thread
+		if(fdc){
+			if (fdc->fd)
+				close(fdc->fd);
+			delete fdc;
+    }
+		iter++;
+	}
+    delete(this->_fdc_map);
+
+    pthread_mutex_unlock(&_data_lock);
+
+    pthread_mutex_destroy(&this->_data_lock);
+    pthread_mutex_destroy(&this->_chunk_mutex);
+    pthread_cond_destroy(&this->_chunk_cond);
+    pthread_mutex_destroy(&this->own_req_lock);
+    pthread_cond_destroy(&this->own_req_cond);
+}
+#if _BullseyeCoverage
+	#pragma BullseyeCoverage on
+#endif
+
+/*static*/ void *EngineWorker::run_start(void *context) throw (UdaException*)
+{
+	((EngineWorker*)context)->run();
+	return NULL;
+}
+
+void
+EngineWorker::insert_req(shuffle_req_t *req)
+{
+    pthread_mutex_lock(&own_req_lock);
+    list_add_tail(&req->list, &own_req_list);
+    pthread_cond_signal(&own_req_cond);
+    pthread_mutex_unlock(&own_req_lock);
+}
+
+// the CPUs of a NUMA node, as listed by sysfs (e.g. "0-7,16-23")
+static bool get_node_cpus(int node, cpu_set_t *cpus)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		return false;
+	}
+
+	CPU_ZERO(cpus);
+	int first, last;
+	char sep;
+	while (fscanf(f, "%d", &first) == 1) {
+		last = first;
+		sep = fgetc(f);
+		if (sep == '-') {
+			if (fscanf(f, "%d", &last) != 1) break;
+			sep = fgetc(f);
+		}
+		for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+			CPU_SET(cpu, cpus);
+		}
+		if (sep != ',') break;
+	}
+	fclose(f);
+	return CPU_COUNT(cpus) > 0;
+}
+
+void
+EngineWorker::bind_to_node()
+{
+	int num_nodes = 0;
+	cpu_set_t cpus;
+	while (get_node_cpus(num_nodes, &cpus)) {
+		++num_nodes;
+	}
+	if (num_nodes < 2) {
+		return;
+	}
+
+	int node = id % num_nodes;
+	get_node_cpus(node, &cpus);
+	int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (rc) {
+		log(lsWARN, "DataEngine worker %d: failed to bind to NUMA node %d (rc=%d)", id, node, rc);
+		return;
+	}
+	log(lsINFO, "DataEngine worker %d: bound to NUMA node %d", id, node);
+}
+
+void
+EngineWorker::run()
+{
+	if (engine->bind_numa) {
+		bind_to_node(); // before starting the reader threads, which inherit the binding
+	}
+	_reader->start();
 
 	this->jniEnv = UdaBridge_attachNativeThread();
 
+    bool batched = false;
+
     /* Wait on the arrival of new MOF files or shuffle requests */
-    while (!this->stop) {
+    while (!engine->stop) {
         shuffle_req_t *req  = NULL;
+        bool got_requests = false;
         // Process new shuffle requests
-        while (!list_empty(&state_mac->mover->incoming_req_list)) {
-			pthread_mutex_lock(&state_mac->mover->in_lock);
+        while (!list_empty(req_list)) {
+			pthread_mutex_lock(req_lock);
 			req = NULL;
-			if (!list_empty(&state_mac->mover->incoming_req_list)) {
-				req = list_entry(state_mac->mover->incoming_req_list.next, typeof(*req), list);
+			if (!list_empty(req_list)) {
+				req = list_entry(req_list->next, typeof(*req), list);
 				list_del(&req->list);
 			}
-			pthread_mutex_unlock(&this->state_mac->mover->in_lock);
+			pthread_mutex_unlock(req_lock);
 
             if(req) {
+            	got_requests = true;
             	log(lsDEBUG, "DataEngine: received shuffle request - JOBID=%s REDUCEID=%d MAP=%s offset=%lld", req->m_jobid.c_str(), req->reduceID, req->m_map.c_str(), req->map_offset);
-            	if (req->chunk_size > this->rdma_buf_size) {
-            		log(lsERROR, "shuffle request chunk size is larger than rdma buffer(chunk_size=%d rdma_buf_size=%d)", req->chunk_size, this->rdma_buf_size);
+            	if (req->chunk_size > engine->rdma_buf_size) {
+            		log(lsERROR, "shuffle request chunk size is larger than rdma buffer(chunk_size=%d rdma_buf_size=%d)", req->chunk_size, engine->rdma_buf_size);
             		// TODO: report TT for task failure
             		delete req;
             	}
@@ -174,25 +384,41 @@ DataEngine::start()
             }
         }
 
-        _aioHandler->submit();
+        // when the reads would queue for a busy disk anyway, a short wait lets the rest
+        // of a burst join them and be ordered with them
+        if (engine->disk_batch_usec && got_requests && !batched && has_busy_disk()) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)engine->disk_batch_usec * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+
+            batched = true;
+            pthread_mutex_lock(req_lock);
+            if (list_empty(req_list) && !engine->stop)
+                pthread_cond_timedwait(req_cond, req_lock, &deadline);
+            pthread_mutex_unlock(req_lock);
+            continue;
+        }
+        batched = false;
+
+        submit_reads(false);
 
 
-        /* check if there is a new incoming shuffle req */
-        pthread_mutex_lock(&state_mac->mover->in_lock);
-        if (!list_empty(&state_mac->mover->incoming_req_list)){
-            pthread_mutex_unlock(&state_mac->mover->in_lock);
+        /* check if there is a new incoming shuffle req, or a disk that may take more reads */
+        pthread_mutex_lock(req_lock);
+        if (!list_empty(req_list) || engine->stop || _reschedule){
+            _reschedule = false;
+            pthread_mutex_unlock(req_lock);
             continue;
         }
-        pthread_cond_wait(&state_mac->mover->in_cond,
-                          &state_mac->mover->in_lock);
-		pthread_mutex_unlock(&state_mac->mover->in_lock);
+        pthread_cond_wait(req_cond, req_lock);
+		pthread_mutex_unlock(req_lock);
 	}
-
-    output_stdout("DataEngine stopped");
 }
 
 
-fd_counter_t* DataEngine::getFdCounter(const string& data_path) {
+fd_counter_t* EngineWorker::getFdCounter(const string& data_path) {
 	fd_counter_t* fdcPtr=NULL;
 
 	pthread_mutex_lock(&this->_data_lock);
@@ -206,13 +432,13 @@ fd_counter_t* DataEngine::getFdCounter(const string& data_path) {
 		fdcPtr->fd=0;
 		fdcPtr->counter=0;
 
-		fdcPtr->fd = open(data_path.c_str() , O_RDONLY | O_DIRECT);
+		fdcPtr->fd = open(data_path.c_str() , O_RDONLY | (engine->direct_io ? O_DIRECT : 0));
 
 		if (fdcPtr->fd < 0) {
 			log(lsERROR, "open mof %s failed - errno=%m", data_path.c_str());
-			if ((errno == EMFILE) && (_kernel_fd_rlim.rlim_max)) {
-				log(lsWARN, "Hard rlimit for max open FDs by this process: %lu", _kernel_fd_rlim.rlim_max);
-				log(lsWARN, "Soft rlimit for max open FDs by this process: %lu", _kernel_fd_rlim.rlim_cur);
+			if ((errno == EMFILE) && (engine->_kernel_fd_rlim.rlim_max)) {
+				log(lsWARN, "Hard rlimit for max open FDs by this process: %lu", engine->_kernel_fd_rlim.rlim_max);
+				log(lsWARN, "Soft rlimit for max open FDs by this process: %lu", engine->_kernel_fd_rlim.rlim_cur);
 			}
 			pthread_mutex_unlock(&this->_data_lock);
 			delete fdcPtr;
@@ -235,24 +461,34 @@ fd_counter_t* DataEngine::getFdCounter(const string& data_path) {
 
 
 int
-DataEngine::process_shuffle_request(shuffle_req_t* req) {
+EngineWorker::process_shuffle_request(shuffle_req_t* req) {
     chunk_t* chunk;
     int rc=0;
     index_record_t *index_rec;
 
-    //first time fetch - need to go to java and get mof path and other data
+    //first time fetch - need the mof path and other data from the index cache, or else from java
     if (req->record->path.empty()) {
-		index_rec =  UdaBridge_invoke_getPathUda_callback(this->jniEnv, req->m_jobid.c_str(), req->m_map.c_str(), req->reduceID);
-		if (!index_rec){
-			log(lsERROR, "UDA bridge failed!");
-			return -1;
+		IndexCache *cache = engine->index_cache;
+		index_rec = cache ? cache->lookup(req->m_jobid, req->m_map, req->reduceID) : NULL;
+		if (!index_rec) {
+			index_rec =  UdaBridge_invoke_getPathUda_callback(this->jniEnv, req->m_jobid.c_str(), req->m_map.c_str(), req->reduceID);
+			if (!index_rec){
+				log(lsERROR, "UDA bridge failed!");
+				return -1;
+			}
+			if (cache)
+				cache->load(req->m_jobid, req->m_map, index_rec->path);
 		}
+		delete req->record;
 		req->record = index_rec;
 	}
 
+    if (engine->coalesce_reads && join_open_read(req))
+    	return 0;
+
     // in case we have no more chunks to occupy , then we should submit current aio waiting requests before WAITing for a chunk.
 	if (list_empty(&this->_free_chunks_list))
-    	_aioHandler->submit();
+    	submit_reads(true);
 
     // this WAITs on cond in case of no more chunks to occupy
 	chunk = occupy_chunk();
@@ -264,7 +500,7 @@ DataEngine::process_shuffle_request(shuffle_req_t* req) {
 
     if (req->record->path.length() > NETLEV_MOF_PATH_MAX_SIZE) {
     	 req->record->path = "MOF_PATH_SIZE_TOO_LONG";
-    	 state_mac->mover->start_outgoing_req(req, req->record, chunk, req->chunk_size, 0);
+    	 engine->state_mac->mover->start_outgoing_req(req, req->record, chunk, req->chunk_size, 0);
     	 delete(req);
     	 return 0;
     }
@@ -274,7 +510,7 @@ DataEngine::process_shuffle_request(shuffle_req_t* req) {
 }
 
 chunk_t*
-DataEngine::occupy_chunk() {
+EngineWorker::occupy_chunk() {
     chunk_t* retval=NULL;
 
     pthread_mutex_lock(&this->_chunk_mutex);
@@ -285,6 +521,7 @@ DataEngine::occupy_chunk() {
 
 	retval= list_entry(this->_free_chunks_list.next, typeof(*retval), list);
 	list_del(&retval->list);
+	retval->refs = 1;
 
 	pthread_mutex_unlock(&this->_chunk_mutex);
 
@@ -292,23 +529,25 @@ DataEngine::occupy_chunk() {
 }
 
 void
-DataEngine::release_chunk(chunk_t* chunk) {
+EngineWorker::release_chunk(chunk_t* chunk) {
     pthread_mutex_lock(&this->_chunk_mutex);
-    list_add_tail(&chunk->list, &this->_free_chunks_list);
-    pthread_cond_signal(&this->_chunk_cond);
+    if (--chunk->refs == 0) {
+        list_add_tail(&chunk->list, &this->_free_chunks_list);
+        pthread_cond_signal(&this->_chunk_cond);
+    }
     pthread_mutex_unlock(&this->_chunk_mutex);
 
 }
 
 
-int DataEngine::aio_read_chunk_data(shuffle_req_t* req , chunk_t* chunk, uint64_t map_offset)
+int EngineWorker::aio_read_chunk_data(shuffle_req_t* req , chunk_t* chunk, uint64_t map_offset)
 {
     int rc=0;
 
     int64_t offset = req->record->offset + map_offset;
     size_t read_length = req->record->partLength - map_offset;
    	read_length = (read_length < (size_t)req->chunk_size ) ? read_length : req->chunk_size ;
-    log (lsDEBUG, "this->rdma_buf_size inside aio_read_chunk_data is %d\n", this->rdma_buf_size);
+    log (lsDEBUG, "this->rdma_buf_size inside aio_read_chunk_data is %d\n", engine->rdma_buf_size);
 
     fd_counter_t* fdc=getFdCounter(req->record->path);
     if (!fdc) {
@@ -319,58 +558,225 @@ int DataEngine::aio_read_chunk_data(shuffle_req_t* req , chunk_t* chunk, uint64_
 	req_callback_arg *cb_arg = new req_callback_arg(); // AIOHandler event processor will delete the allocated cb_arg
 	cb_arg->chunk=chunk;
     cb_arg->shreq=req;
-    cb_arg->state_mac = this->state_mac;
+    cb_arg->state_mac = engine->state_mac;
     cb_arg->readLength=read_length;
     cb_arg->record=req->record;
-    cb_arg->offsetAligment= (offset & _aioHandler->ALIGMENT_MASK);
+    cb_arg->offsetAligment= (offset & AIOHandler::ALIGMENT_MASK);
     cb_arg->fdc=fdc;
     cb_arg->fdc_key = req->record->path;
-    size_t length_for_aio = read_length + 2*AIO_ALIGNMENT - (read_length & _aioHandler->ALIGMENT_MASK);
+    cb_arg->worker = this;
+    size_t length_for_aio = read_length + 2*AIO_ALIGNMENT - (read_length & AIOHandler::ALIGMENT_MASK);
+
+    cb_arg->fileOffset = offset;
+    cb_arg->readStart = offset - cb_arg->offsetAligment;
+    cb_arg->readEnd = cb_arg->readStart + length_for_aio;
+    cb_arg->next = NULL;
+    cb_arg->disk = engine->disk_of(cb_arg->fdc_key);
+    log(lsTRACE,"Preparing AIO READ: MOF=%s OFFSET=%d ALIGNED_OFFSET=%lld LENGTH=%lld ALIGNED_LENGTH=%lld", req->record->path.c_str(), offset, cb_arg->readStart,read_length, length_for_aio );
+
+    // the read stays open for the next requests of the MOF, and for the elevator of its disk, until submit_reads
+    _disks[cb_arg->disk].open_reads.insert(pair<string, req_callback_arg*>(cb_arg->fdc_key, cb_arg));
+    return rc;
+}
+
+bool EngineWorker::join_open_read(shuffle_req_t* req)
+{
+    int64_t offset = req->record->offset + req->map_offset;
+    size_t read_length = req->record->partLength - req->map_offset;
+    read_length = (read_length < (size_t)req->chunk_size ) ? read_length : req->chunk_size ;
+    uint64_t start = offset - (offset & AIOHandler::ALIGMENT_MASK);
+    uint64_t end = start + read_length + 2*AIO_ALIGNMENT - (read_length & AIOHandler::ALIGMENT_MASK);
+
+    multimap<string, req_callback_arg*> &open_reads = _disks[engine->disk_of(req->record->path)].open_reads;
+    pair<multimap<string, req_callback_arg*>::iterator, multimap<string, req_callback_arg*>::iterator> range = open_reads.equal_range(req->record->path);
+    req_callback_arg *read = NULL;
+    for (multimap<string, req_callback_arg*>::iterator iter = range.first; iter != range.second && !read; ++iter) {
+    	if (max(end, iter->second->readEnd) - min(start, iter->second->readStart) <= (uint64_t)engine->rdma_buf_size + 2*AIO_ALIGNMENT)
+    		read = iter->second;
+    }
+    if (!read)
+    	return false;
+    start = min(start, read->readStart);
+    end = max(end, read->readEnd);
+
+    req_callback_arg *cb_arg = new req_callback_arg();
+    cb_arg->chunk = read->chunk;
+    cb_arg->shreq = req;
+    cb_arg->state_mac = engine->state_mac;
+    cb_arg->readLength = read_length;
+    cb_arg->record = req->record;
+    cb_arg->worker = this;
+    cb_arg->fileOffset = offset;
+    cb_arg->disk = read->disk;
+    cb_arg->next = read->next;
+    read->next = cb_arg;
+    read->readStart = start;
+    read->readEnd = end;
+
+    log(lsTRACE, "coalesced AIO READ: MOF=%s OFFSET=%lld LENGTH=%lld into ALIGNED_OFFSET=%lld ALIGNED_LENGTH=%lld", req->record->path.c_str(), (long long)offset, (long long)read_length, (long long)start, (long long)(end - start));
+    return true;
+}
 
-    long new_offset=offset - cb_arg->offsetAligment;
-    log(lsTRACE,"Preparing AIO READ: MOF=%s OFFSET=%d ALIGNED_OFFSET=%lld LENGTH=%lld ALIGNED_LENGTH=%lld", req->record->path.c_str(), offset, new_offset,read_length, length_for_aio );
-    rc = _aioHandler->prepare_read(fdc->fd, new_offset, length_for_aio, chunk->buff, cb_arg);
+void EngineWorker::prepare_read(req_callback_arg *read)
+{
+    uint64_t start = read->readStart;
+    uint64_t end = read->readEnd;
+    if (!engine->direct_io) {
+    	// buffered reads need no alignment, so that a short read is an error
+    	start = read->fileOffset;
+    	end = read->fileOffset + read->readLength;
+    	for (req_callback_arg *arg = read->next; arg; arg = arg->next) {
+    		start = min(start, arg->fileOffset);
+    		end = max(end, arg->fileOffset + arg->readLength);
+    	}
+    }
 
-    return rc;
+    int refs = 0;
+    for (req_callback_arg *arg = read; arg; arg = arg->next) {
+    	arg->offsetAligment = arg->fileOffset - start;
+    	++refs;
+    }
+    read->chunk->refs = refs; // each request releases the chunk once its RDMA write is done
+
+    // on failure, the reader calls back and the requests of the read are dropped
+    _reader->insert(new ReadRequest(read->fdc_key, start, end - start, read->fdc->fd, read->chunk->buff, read));
+}
+
+void EngineWorker::submit_reads(bool all)
+{
+    for (size_t i = 0; i < _disks.size(); ++i) {
+    	dispatch_reads(_disks[i], all);
+    }
+    _reader->submit();
+}
+
+typedef multimap<string, req_callback_arg*>::iterator open_read_iter;
+
+static bool read_before(const open_read_iter &a, const open_read_iter &b)
+{
+    int cmp = a->first.compare(b->first);
+    return cmp < 0 || (cmp == 0 && a->second->readStart < b->second->readStart);
+}
+
+void EngineWorker::dispatch_reads(disk_sched_t &disk, bool all)
+{
+    if (disk.open_reads.empty())
+    	return;
+
+    vector<open_read_iter> reads;
+    for (open_read_iter iter = disk.open_reads.begin(); iter != disk.open_reads.end(); ++iter) {
+    	reads.push_back(iter);
+    }
+    sort(reads.begin(), reads.end(), read_before);
+
+    // the sweep goes on from the last dispatched read, and then wraps around
+    size_t first = 0;
+    while (first < reads.size()) {
+    	int cmp = reads[first]->first.compare(disk.last_path);
+    	if (cmp > 0 || (cmp == 0 && reads[first]->second->readStart > disk.last_offset))
+    		break;
+    	++first;
+    }
+
+    for (size_t i = 0; i < reads.size(); ++i) {
+    	pthread_mutex_lock(&_data_lock);
+    	bool full = !all && engine->disk_in_flight && disk.in_flight >= engine->disk_in_flight;
+    	if (!full)
+    		disk.in_flight++;
+    	pthread_mutex_unlock(&_data_lock);
+    	if (full)
+    		break; // the rest waits for a completion on the disk
+
+    	open_read_iter iter = reads[(first + i) % reads.size()];
+    	req_callback_arg *read = iter->second;
+    	disk.last_path = iter->first;
+    	disk.last_offset = read->readStart;
+    	disk.open_reads.erase(iter);
+    	prepare_read(read);
+    }
+}
+
+bool EngineWorker::has_busy_disk()
+{
+    bool busy = false;
+    pthread_mutex_lock(&_data_lock);
+    for (size_t i = 0; i < _disks.size() && !busy; ++i) {
+    	busy = !_disks[i].open_reads.empty() && _disks[i].in_flight > 0;
+    }
+    pthread_mutex_unlock(&_data_lock);
+    return busy;
+}
+
+int EngineWorker::hasFreeBuffer() {
+	pthread_mutex_lock(&this->_chunk_mutex);
+	int rc = !list_empty(&this->_free_chunks_list);
+	pthread_mutex_unlock(&this->_chunk_mutex);
+	return rc;
+}
+
+int EngineWorker::readCallback(ReadCallbackArg* arg, int status) {
+	return aio_completion_handler(arg->opaque, status);
 }
 
 int aio_completion_handler(void* data, int aio_status) {
 	req_callback_arg *req_cb_arg = (req_callback_arg*)data;
 
-	log(lsTRACE, "on AIO callback: JOB=%s MAP=%s REDUCERID=%d REMOTE_HOST=%lld MAP_OFFSET=%lld ---> AIO_STATUS=%d", req_cb_arg->shreq->m_jobid.c_str(), req_cb_arg->shreq->m_map.c_str(), req_cb_arg->shreq->reduceID, req_cb_arg->shreq->remote_addr, req_cb_arg->shreq->map_offset, aio_status);
-	if (!aio_status){
-		//aio request ended successfully
-		req_cb_arg->state_mac->mover->start_outgoing_req(req_cb_arg->shreq, req_cb_arg->record, req_cb_arg->chunk, req_cb_arg->readLength, req_cb_arg->offsetAligment);
-	}//TODO: else: send NACK
-	else {
+	if (aio_status) {
 		log(lsERROR, "Bad AIO operation status = %d", aio_status);
+	}
 
+	// the read's chunk is written to each of its requests
+	for (req_callback_arg *arg = req_cb_arg; arg; arg = arg->next) {
+		log(lsTRACE, "on AIO callback: JOB=%s MAP=%s REDUCERID=%d REMOTE_HOST=%lld MAP_OFFSET=%lld ---> AIO_STATUS=%d", arg->shreq->m_jobid.c_str(), arg->shreq->m_map.c_str(), arg->shreq->reduceID, arg->shreq->remote_addr, arg->shreq->map_offset, aio_status);
+		if (!aio_status){
+			//aio request ended successfully
+			arg->state_mac->mover->start_outgoing_req(arg->shreq, arg->record, arg->chunk, arg->readLength, arg->offsetAligment);
+		}
+		else { //TODO: send NACK
+			arg->state_mac->data_mac->release_chunk(arg->chunk); // nothing is written from it
+		}
 	}
 
 	fd_counter_t* fdc=req_cb_arg->fdc;
-	DataEngine      *data_eng = req_cb_arg->state_mac->data_mac;
+	EngineWorker    *worker = req_cb_arg->worker;
 
-	pthread_mutex_lock(&data_eng->_data_lock);
+	pthread_mutex_lock(&worker->_data_lock);
 
+	worker->_disks[req_cb_arg->disk].in_flight--;
 	fdc->counter--;
-	if (!fdc->counter){
+	// decided under the lock: the blocked reader completes reads of the same fd
+	// concurrently, and the last of them deletes fdc
+	bool last_read = !fdc->counter;
+	if (last_read){
 		string key=req_cb_arg->fdc_key;
-		path_fd_iter iter = data_eng->_fdc_map->find(key);
+		path_fd_iter iter = worker->_fdc_map->find(key);
 
 		//delete from map
-		data_eng->_fdc_map->erase(iter);
+		worker->_fdc_map->erase(iter);
 	}
 
-	pthread_mutex_unlock(&data_eng->_data_lock);
-	if (!fdc->counter){
+	pthread_mutex_unlock(&worker->_data_lock);
+	if (last_read){
 		log(lsDEBUG, "close MOF fd");
 		close(fdc->fd);
 		delete (fdc);
 	}
 
-	delete req_cb_arg->shreq;
-	delete req_cb_arg->record;
-    delete req_cb_arg;
+	if (worker->engine->disk_in_flight) {
+		// reads that wait for the disk may go now
+		pthread_mutex_lock(worker->req_lock);
+		worker->_reschedule = true;
+		pthread_cond_broadcast(worker->req_cond);
+		pthread_mutex_unlock(worker->req_lock);
+	}
+
+	while (req_cb_arg) {
+		req_callback_arg *next = req_cb_arg->next;
+		delete req_cb_arg->shreq;
+		delete req_cb_arg->record;
+		delete req_cb_arg;
+		req_cb_arg = next;
+	}
 
     return 0;
 }
@@ -32,19 +32,20 @@ using namespace std;
 #include <map>
 #include <vector>
 #include "LinkList.h"
+#include "IOUtility.h"
 #include "AIOHandler.h"
+#include "../AsyncIO/AbstractReader.h"
 #include "../DataNet/RDMAComm.h"
 
 
-#define AIOHANDLER_MIN_NR			(1)
-#define AIOHANDLER_NR				(50)
-#define AIOHANDLER_TIMEOUT_IN_NSEC	(300000000)
-#define AIOHANDLER_CTX_MAXEVENTS	NETLEV_RDMA_MEM_CHUNKS_NUM
+#define AIOHANDLER_CTX_MAXEVENTS	NETLEV_RDMA_MEM_CHUNKS_NUM // reads in flight are bounded by the chunks
 
 class OutputServer;
 class ShuffleReq;
 class C2JNexus;
 class DataEngine;
+class EngineWorker;
+class IndexCache;
 struct netlev_conn;
 
 /*
@@ -124,6 +125,7 @@ typedef struct chunk {
 	uint32_t			type; //!!!!!! type must be at offset 0!!!!!! DO NOT MOVE IT!!!!
     struct list_head 	list;
     char*				buff;
+    int					refs; // RDMA writes from buff that did not complete yet (see EngineWorker::release_chunk)
 } chunk_t;
 
 typedef struct shuffle_request_callback_arg {
@@ -135,8 +137,27 @@ typedef struct shuffle_request_callback_arg {
 	int					offsetAligment;
 	string	     		fdc_key; // passing key of the fd counter to let the completion event handler to close the fd in case counter=0
 	fd_counter_t*		fdc; //passing the value to avoid log(N) for each aio completion
+	EngineWorker*		worker; // owns fdc
+	uint64_t			fileOffset; // of the request's data in the MOF
+	uint64_t			readStart;  // aligned range of the AIO, kept by the first request of the read
+	uint64_t			readEnd;
+	struct shuffle_request_callback_arg* next; // requests of the same MOF that were coalesced into this read
+	int					disk; // index of the local dir of the MOF (see DataEngine::disk_of)
 } req_callback_arg;
 
+/*
+ * The reads of a worker on one disk, which it prepares in elevator order:
+ * sorted by (MOF path, offset), continuing the sweep from where the last
+ * dispatched read stopped, so every waiting reducer is served within a sweep.
+ */
+typedef struct disk_sched
+{
+    multimap<string, req_callback_arg*> open_reads; // not prepared yet, by MOF path
+    int                  in_flight; // prepared reads that did not complete, under _data_lock
+    string               last_path; // position of the elevator
+    uint64_t             last_offset;
+} disk_sched_t;
+
 
 
 
@@ -144,59 +165,72 @@ typedef struct shuffle_request_callback_arg {
 int aio_completion_handler(void* data, int success);
 
 
-class DataEngine
+#define ENGINE_WORKERS "1" // default of mapred.rdma.supplier.engine.threads
+
+/*
+ * One thread of the DataEngine: reads the requested MOF chunks with its own reader
+ * (AIO context or per-disk pread threads), from its own slice of the chunk pool and
+ * its own open MOFs.
+ */
+class EngineWorker : public AbstractReader::Subscriber
 {
 public:
-    supplier_state_t    *state_mac;
-    bool                 stop;
-    int                  rdma_buf_size;
-    JNIEnv               *jniEnv;
     pthread_mutex_t      _data_lock;
     map<string, fd_counter_t*>* _fdc_map;
 
-    DataEngine(void *mem,supplier_state_t *state,
-               const char *path, int mode, int rdma_buf_size, struct rlimit kernel_fd_rlim);
-    ~DataEngine();
+    /* requests come from req_list, which is the mover's incoming_req_list for a
+     * single worker, otherwise a list of the worker that DataEngine::start feeds */
+    EngineWorker(DataEngine *engine, int id, struct list_head *req_list, pthread_mutex_t *req_lock, pthread_cond_t *req_cond);
+    ~EngineWorker();
 
-    // produce chunk buffer to pool
+    // produce chunk buffer to pool, once all its RDMA writes are done
     // send condition signal if pool was empty
     void release_chunk(chunk_t* chunk);
 
-    /* XXX:Start the data engine thread for new requests and MOFs */
-    void start();
+    // processes requests until the engine stops
+    void run();
+    static void *run_start(void *context) throw (UdaException*);
 
-	#if _BullseyeCoverage
-		#pragma BullseyeCoverage off
-	#endif
-	pthread_t get_engine_pthread() { return _thread_id; }
-	#if _BullseyeCoverage
-		#pragma BullseyeCoverage on
-	#endif
+    // for feeding the own request list
+    void insert_req(shuffle_req_t *req);
 
+    // AbstractReader::Subscriber - the requests of the reader come with their fd and chunk,
+    // so prepareRead is not called (a NULL would fail the read through readCallback)
+    int hasFreeBuffer();
+    ReadCallbackArg* prepareRead(ReadRequest* req , bool shouldUseOsCache) { return NULL; }
+    int readCallback(ReadCallbackArg* data, int status);
 
-private:
-    pthread_t 			_thread_id;
-    AIOHandler* 		_aioHandler;
-    struct list_head    _free_chunks_list;
-    chunk_t*			_chunks;
-    pthread_cond_t      _chunk_cond;
-    pthread_mutex_t		_chunk_mutex;
-    struct rlimit 		_kernel_fd_rlim;
-
+    const int            id;
+    pthread_t            thread; // 0 when run by the engine's thread
+    struct list_head     own_req_list;
+    pthread_mutex_t      own_req_lock;
+    pthread_cond_t       own_req_cond;
 
+private:
+    DataEngine          *engine;
+    JNIEnv              *jniEnv;
+    AbstractReader*      _reader;
+    struct list_head     _free_chunks_list;
+    pthread_cond_t       _chunk_cond;
+    pthread_mutex_t      _chunk_mutex;
+    struct list_head    *req_list;
+    pthread_mutex_t     *req_lock;
+    pthread_cond_t      *req_cond;
+
+    // reads that are not prepared yet, which the next requests of their MOF may join, by disk
+    std::vector<disk_sched_t> _disks;
+    bool                 _reschedule; // under req_lock, set when a read completes on a disk with waiting reads
 
     /*
      * get the specific fd counter structure related with data_path
      * if not exists then create&initialize new one.
-     * this method is not THREAD_SAFE
      */
     fd_counter_t* getFdCounter(const string& data_path);
 
-
     /**
      * 1) retrieve_path
      * 2) getIFile
-     * 3) if necessary then aioHandler->submit() to release chunks
+     * 3) if necessary then submit_reads() to release chunks
      * 4) occupy_chunk()
      * 5) aio_read_chunk_data
      * return 0 on SUCCESS
@@ -204,30 +238,100 @@ private:
     int process_shuffle_request(shuffle_req_t* req);
 
     /**
-     * 1) get opened fd from job to FdCounters map ,  re/open fd with O_DIRECT flag
+     * 1) get opened fd from job to FdCounters map ,  re/open fd (with O_DIRECT flag for aio)
      * 2) inc fdCounter (aio callback decrements it and closes the fd in case counter=0)
      * 3) prepare suitable callback argument for aio
-     * 4) _aioHandler->prepare_read
+     * 4) open a read for the request, which submit_reads passes to the reader
      */
     int aio_read_chunk_data(shuffle_req_t* req, chunk_t* chunk, uint64_t map_offset);
 
+    // adds the request to an open read of its MOF if together they fit in one chunk
+    // (reading a gap between them is cheaper than a seek) - the data is then written
+    // to each reducer from that chunk
+    bool join_open_read(shuffle_req_t* req);
+
+    // inserts a read and its coalesced requests to the reader, which drops them on failure
+    void prepare_read(req_callback_arg *read);
+
+    // prepares the open reads, within the in-flight limit of their disks unless all,
+    // and submits all the prepared reads
+    void submit_reads(bool all);
+
+    // prepares the open reads of a disk in elevator order
+    void dispatch_reads(disk_sched_t &disk, bool all);
+
+    // a disk has open reads and reads in flight
+    bool has_busy_disk();
+
+    friend int aio_completion_handler(void* data, int success);
+
     // consumes chunk buffer from pool
     // WAIT on condition if no chunks available
     chunk_t* occupy_chunk();
 
+    // pins the thread to the CPUs of NUMA node (id % nodes) - see mapred.rdma.supplier.engine.numa
+    void bind_to_node();
+};
+
+class DataEngine
+{
+public:
+    supplier_state_t    *state_mac;
+    bool                 stop;
+    int                  rdma_buf_size;
+    struct rlimit        _kernel_fd_rlim;
+    bool                 bind_numa; // pin the workers to NUMA nodes round robin
+    bool                 coalesce_reads; // concurrent requests of a MOF share reads (mapred.rdma.supplier.coalesce.reads)
+    std::vector<string>  local_dirs; // mapred.local.dir, a disk each
+    int                  disk_in_flight; // max reads on a disk per worker, 0 for no limit (mapred.rdma.supplier.disk.inflight)
+    int                  disk_batch_usec; // wait for more requests before ordering them (mapred.rdma.supplier.disk.batch.usec)
+    string               read_mode; // "aio" or "blocked" (mapred.rdma.supplier.read.mode, see AbstractReader::create)
+    bool                 direct_io; // aio reads with O_DIRECT, blocked ones through the page cache
+
+    // index of the local dir of path, or local_dirs.size() if it is in none
+    int disk_of(const string &path);
+    IndexCache          *index_cache; // shared by the workers, NULL when disabled
+
+    DataEngine(void *mem,supplier_state_t *state,
+               const char *path, int mode, int rdma_buf_size, struct rlimit kernel_fd_rlim);
+    ~DataEngine();
+
+    // produce chunk buffer to the pool of its worker
+    void release_chunk(chunk_t* chunk);
+
+    /* XXX:Start the data engine thread for new requests and MOFs */
+    void start();
+
+	#if _BullseyeCoverage
+		#pragma BullseyeCoverage off
+	#endif
+	pthread_t get_engine_pthread() { return _thread_id; }
+	#if _BullseyeCoverage
+		#pragma BullseyeCoverage on
+	#endif
+
+
+private:
+    pthread_t 			_thread_id;
+    chunk_t*			_chunks;
+    std::vector<EngineWorker*> _workers; // chunk i belongs to worker i % _workers.size()
+
+    // a MOF is always read by the same worker, which keeps its fd local
+    EngineWorker* worker_of(const shuffle_req_t *req);
+
+    // passes the mover's requests to their workers until stop
+    void dispatch_requests();
+
     /* Initialize the cache tables with provided memory */
     void prepare_tables(void *mem, int rdma_buf_size);
 
     /*
-     * 1) cleanJob for all jobs
+     * 1) delete the workers (their open MOFs)
      * 2) free RDMA chunks
-     * 3) destroy all mutex&cond
      *
      * Dtor calls this method
      */
     void cleanup_tables();
-
-
 };
 
 
@@ -27,6 +27,7 @@
 
 #include "MOFServer/MOFServlet.h"
 #include "MOFServer/IndexInfo.h"
+#include "MOFServer/IndexCache.h"
 #include "include/IOUtility.h"
 
 using namespace std;
@@ -59,6 +60,11 @@ void mof_downcall_handler(const std::string & msg)
            the intermediate map output files
         state_mac.data_mac->base_path = strdup(hadoop_cmd.params[0]);*/
 
+    } else if (hadoop_cmd.header == JOB_OVER_MSG && hadoop_cmd.count > 1) {
+        log(lsINFO, "===>>> we got JOB OVER COMMAND for job %s", hadoop_cmd.params[0]);
+        if (state_mac.data_mac && state_mac.data_mac->index_cache)
+            state_mac.data_mac->index_cache->remove_job(hadoop_cmd.params[0]);
+
     } else if (hadoop_cmd.header == EXIT_MSG) {
 
         log(lsINFO, "============>>> we got EXIT COMMAND");
@@ -17,10 +17,18 @@
 **
 */
 
+#include <endian.h>
+#include <dlfcn.h>
+#include <ctype.h>
+#include <map>
+#include <vector>
+#include <string>
 #include "CompareFunc.h"
 
-// Matches BytesWritable's definition of LENGTH_BYTES in Java
-const int LENGTH_BYTES = 4;
+#if defined(__x86_64__) && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define UDA_SIMD_COMPARE 1
+#include <immintrin.h>
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Use the arrays below for defining whether a given type is a 
@@ -41,19 +49,20 @@ const char * BYTES_COMPARABLE[] = {
 		"org.apache.hadoop.hbase.io.ImmutableBytesWritable",
 		NULL};
 
-/*
- // unsupported yet - all are derived of WritableComparable
- // see http://hadoop.apache.org/docs/current/api/org/apache/hadoop/io/WritableComparable.html
-
-org.apache.hadoop.io.DoubleWritable
-org.apache.hadoop.io.FloatWritable
-
-org.apache.hadoop.io.VIntWritable
-org.apache.hadoop.io.VLongWritable
-org.apache.hadoop.mapred.ID (based on int)
-
-//*/
-
+const char * DOUBLE_COMPARABLE[] = {
+		"org.apache.hadoop.io.DoubleWritable",
+		NULL};
+const char * FLOAT_COMPARABLE[] = {
+		"org.apache.hadoop.io.FloatWritable",
+		NULL};
+const char * VLONG_COMPARABLE[] = {
+		"org.apache.hadoop.io.VIntWritable",
+		"org.apache.hadoop.io.VLongWritable",
+		NULL};
+const char * ID_COMPARABLE[] = {
+		"org.apache.hadoop.mapred.ID",
+		"org.apache.hadoop.mapreduce.ID",
+		NULL};
 
 ////////////////////////////////////////////////////////////////////////////////
 static bool str_in_array(const char* str, const char *arr[]){
@@ -67,33 +76,545 @@ static bool str_in_array(const char* str, const char *arr[]){
 
 
 ////////////////////////////////////////////////////////////////////////////////
-static inline int byte_compare_inline(char* key1, int len1, char* key2, int len2) {
-	int cmp_res =  memcmp(key1, key2, ((len1 < len2) ? len1 : len2));
-	return (cmp_res) ? (cmp_res) : (len1 - len2);
+// memcmp-like kernels for long keys (e.g. row keys with long common prefixes).
+// the SIMD ones are compiled for their instruction set by the target attribute
+// and are used on request, if the CPU supports them.
+//
+static int byte_diff_scalar(const char* p1, const char* p2, int n) {
+	return memcmp(p1, p2, n);
+}
+
+#ifdef UDA_SIMD_COMPARE
+// n >= 16: 16 bytes at a time with PCMPESTRI; the tail is an overlapping last block,
+// whose bytes before the tail are known to be equal
+__attribute__((target("sse4.2")))
+static int byte_diff_sse42(const char* p1, const char* p2, int n) {
+	const int mode = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_EACH | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT;
+	int i = 0;
+	for (;;) {
+		if (i > n - 16) i = n - 16;
+		__m128i a = _mm_loadu_si128((const __m128i*)(p1 + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(p2 + i));
+		int idx = _mm_cmpestri(a, 16, b, 16, mode);
+		if (idx < 16) return (int)(uint8_t)p1[i + idx] - (int)(uint8_t)p2[i + idx];
+		if (i == n - 16) return 0;
+		i += 16;
+	}
+}
+
+// n >= 16: 32 bytes at a time, and 16 for n < 32
+__attribute__((target("avx2")))
+static int byte_diff_avx2(const char* p1, const char* p2, int n) {
+	if (n < 32) {
+		uint32_t mask = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i*)p1), _mm_loadu_si128((const __m128i*)p2))) & 0xffff;
+		int i = 0;
+		if (!mask) {
+			i = n - 16;
+			mask = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+					_mm_loadu_si128((const __m128i*)(p1 + i)), _mm_loadu_si128((const __m128i*)(p2 + i)))) & 0xffff;
+			if (!mask) return 0;
+		}
+		i += __builtin_ctz(mask);
+		return (int)(uint8_t)p1[i] - (int)(uint8_t)p2[i];
+	}
+
+	int i = 0;
+	// 64 bytes per iteration with a single test
+	for (; i + 64 <= n; i += 64) {
+		__m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p1 + i)), _mm256_loadu_si256((const __m256i*)(p2 + i)));
+		__m256i eq2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p1 + i + 32)), _mm256_loadu_si256((const __m256i*)(p2 + i + 32)));
+		if ((uint32_t)_mm256_movemask_epi8(_mm256_and_si256(eq1, eq2)) != 0xffffffff) {
+			uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(eq1);
+			if (!mask) {
+				mask = ~(uint32_t)_mm256_movemask_epi8(eq2);
+				i += 32;
+			}
+			i += __builtin_ctz(mask);
+			return (int)(uint8_t)p1[i] - (int)(uint8_t)p2[i];
+		}
+	}
+	if (i == n) return 0;
+
+	// the rest, in (overlapping) 32 byte blocks
+	for (;;) {
+		if (i > n - 32) i = n - 32;
+		uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i*)(p1 + i)), _mm256_loadu_si256((const __m256i*)(p2 + i))));
+		if (mask) {
+			i += __builtin_ctz(mask);
+			return (int)(uint8_t)p1[i] - (int)(uint8_t)p2[i];
+		}
+		if (i == n - 32) return 0;
+		i += 32;
+	}
+}
+#endif
+
+// glibc's memcmp is vectorized already: avx2 wins only on some keys of 16-32 bytes and
+// loses on long keys (CompareFunc_bench), and PCMPESTRI is slower still
+static byte_diff_func auto_byte_diff_func() {
+	return byte_diff_scalar;
+}
+
+// for n >= SIMD_COMPARE_MIN_LEN
+byte_diff_func g_byte_diff_func = byte_diff_scalar;
+bool g_byte_diff_simd = false;
+
+byte_diff_func get_byte_diff_func(const char* name) {
+	if (strcmp(name, "auto") == 0) return auto_byte_diff_func();
+	if (strcmp(name, "scalar") == 0) return byte_diff_scalar;
+#ifdef UDA_SIMD_COMPARE
+	__builtin_cpu_init();
+	if (strcmp(name, "sse42") == 0 && __builtin_cpu_supports("sse4.2")) return byte_diff_sse42;
+	if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) return byte_diff_avx2;
+#endif
+	return NULL;
+}
+
+void select_byte_diff_func(const char* name) {
+	byte_diff_func func = get_byte_diff_func(name);
+	if (!func) {
+		log(lsWARN, "compare kernel '%s' is not supported, using the default", name);
+		func = auto_byte_diff_func();
+	}
+	g_byte_diff_func = func;
+	g_byte_diff_simd = (func != byte_diff_scalar);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 static int byte_compare(char* key1, int len1, char* key2, int len2) {
-	return byte_compare_inline(key1, len1, key2, len2);
+	return ByteKeyCompare::compare(key1, len1, key2, len2);
 }
         
 
 ////////////////////////////////////////////////////////////////////////////////
 static int text_compare(char* key1, int len1, char* key2, int len2) {
-	int k1_skip_bytes = StreamUtility::decodeVIntSize((int)(key1[0]));
-	int k2_skip_bytes = StreamUtility::decodeVIntSize((int)(key2[0]));
-	return byte_compare_inline(key1 + k1_skip_bytes, len1 - k1_skip_bytes, key2 + k2_skip_bytes, len2 - k2_skip_bytes);
+	return TextKeyCompare::compare(key1, len1, key2, len2);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 static int bytes_compare(char* key1, int len1, char* key2, int len2) {
-	return byte_compare_inline(key1 + LENGTH_BYTES, len1 - LENGTH_BYTES, key2 + LENGTH_BYTES, len2 - LENGTH_BYTES);
+	return BytesKeyCompare::compare(key1, len1, key2, len2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// numeric keys are mapped to unsigned integers with the same order, so that the
+// compare func and the prefix func are the same exact comparison.
+
+// signed -> unsigned by flipping the sign bit
+static inline uint64_t signed_order_key(int64_t v) {
+	return (uint64_t)v ^ 0x8000000000000000ULL;
+}
+
+// Java's Double.compare() order (what DoubleWritable's comparator uses):
+// -0.0 < 0.0 and all NaNs are equal and above +Infinity (doubleToLongBits canonicalizes NaN)
+static inline uint64_t double_order_key(const char* key) {
+	uint64_t bits;
+	memcpy(&bits, key, sizeof(bits));
+	bits = be64toh(bits);
+	if ((bits & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL && (bits & 0x000fffffffffffffULL)) {
+		bits = 0x7ff8000000000000ULL; // NaN
+	}
+	// negatives: reverse their order by flipping all bits; positives: move above negatives
+	return (bits & 0x8000000000000000ULL) ? ~bits : (bits | 0x8000000000000000ULL);
+}
+
+// as above for Float.compare(), in the high half
+static inline uint64_t float_order_key(const char* key) {
+	uint32_t bits;
+	memcpy(&bits, key, sizeof(bits));
+	bits = be32toh(bits);
+	if ((bits & 0x7f800000U) == 0x7f800000U && (bits & 0x007fffffU)) {
+		bits = 0x7fc00000U; // NaN
+	}
+	bits = (bits & 0x80000000U) ? ~bits : (bits | 0x80000000U);
+	return (uint64_t)bits << 32;
+}
+
+// WritableUtils.readVLong() of a serialized VIntWritable/VLongWritable
+static inline int64_t read_vlong(const char* key) {
+	int8_t first = (int8_t)key[0];
+	if (first >= -112) {
+		return first;
+	}
+	bool negative = first < -120;
+	int len = negative ? -120 - first : -112 - first;
+	int64_t v = 0;
+	for (int i = 1; i <= len; ++i) {
+		v = (v << 8) | (uint8_t)key[i];
+	}
+	return negative ? ~v : v;
+}
+
+// ID.write() is writeInt(id)
+static inline int32_t read_int(const char* key) {
+	uint32_t v;
+	memcpy(&v, key, sizeof(v));
+	return (int32_t)be32toh(v);
+}
+
+static inline int unsigned_compare(uint64_t v1, uint64_t v2) {
+	return (v1 < v2) ? -1 : (v1 > v2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static int double_compare(char* key1, int len1, char* key2, int len2) {
+	return unsigned_compare(double_order_key(key1), double_order_key(key2));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static int float_compare(char* key1, int len1, char* key2, int len2) {
+	return unsigned_compare(float_order_key(key1), float_order_key(key2));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static int vlong_compare(char* key1, int len1, char* key2, int len2) {
+	int64_t v1 = read_vlong(key1);
+	int64_t v2 = read_vlong(key2);
+	return (v1 < v2) ? -1 : (v1 > v2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static int id_compare(char* key1, int len1, char* key2, int len2) {
+	int32_t v1 = read_int(key1);
+	int32_t v2 = read_int(key2);
+	return (v1 < v2) ? -1 : (v1 > v2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// first 8 bytes of a byte string as big-endian integer, zero padded.
+// zero padding keeps the order of byte_compare_inline: a shorter string that
+// ties on the padded prefix is either equal or smaller, and ties fall back
+static inline uint64_t byte_prefix_inline(const char* key, int len) {
+	uint64_t prefix = 0;
+	if (len >= (int)sizeof(prefix)) {
+		memcpy(&prefix, key, sizeof(prefix));
+		return be64toh(prefix);
+	}
+	for (int i = 0; i < len; ++i) {
+		prefix |= (uint64_t)(uint8_t)key[i] << (56 - 8 * i);
+	}
+	return prefix;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t no_prefix(char* key, int len) {
+	return 0; // all keys tie - always use the compare func
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t byte_prefix(char* key, int len) {
+	return byte_prefix_inline(key, len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t text_prefix(char* key, int len) {
+	int skip_bytes = StreamUtility::decodeVIntSize((int)(key[0]));
+	return byte_prefix_inline(key + skip_bytes, len - skip_bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t bytes_prefix(char* key, int len) {
+	return byte_prefix_inline(key + LENGTH_BYTES, len - LENGTH_BYTES);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t double_prefix(char* key, int len) {
+	return double_order_key(key);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t float_prefix(char* key, int len) {
+	return float_order_key(key);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t vlong_prefix(char* key, int len) {
+	return signed_order_key(read_vlong(key));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t id_prefix(char* key, int len) {
+	return signed_order_key(read_int(key));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// composite keys - see set_composite_compare_func
+//
+typedef enum {
+	FIELD_BOOLEAN, FIELD_BYTE, FIELD_SHORT, FIELD_INT, FIELD_LONG,
+	FIELD_FLOAT, FIELD_DOUBLE, FIELD_VLONG, FIELD_TEXT
+} key_field_type_t;
+
+typedef struct key_field {
+	key_field_type_t type;
+	bool             descending;
+} key_field_t;
+
+static const struct {
+	const char      *name;
+	key_field_type_t type;
+} KEY_FIELD_NAMES[] = {
+	{"boolean", FIELD_BOOLEAN}, {"byte", FIELD_BYTE}, {"short", FIELD_SHORT},
+	{"int", FIELD_INT}, {"long", FIELD_LONG}, {"float", FIELD_FLOAT}, {"double", FIELD_DOUBLE},
+	{"vint", FIELD_VLONG}, {"vlong", FIELD_VLONG}, {"text", FIELD_TEXT},
+	{NULL, FIELD_TEXT}
+};
+
+// fields of the composite key of this reduce task; the compare funcs have no context,
+// so there is one composite key per process (see set_composite_compare_func)
+static std::vector<key_field_t> g_key_fields;
+
+// order key of a non-text field (as with the numeric keys above); sets the field's size
+static inline uint64_t field_order_key(key_field_type_t type, const char* p, int &size) {
+	switch (type) {
+	case FIELD_BOOLEAN: size = 1; return (uint8_t)p[0];
+	case FIELD_BYTE:    size = 1; return signed_order_key((int8_t)p[0]);
+	case FIELD_SHORT: {
+		uint16_t v;
+		memcpy(&v, p, sizeof(v));
+		size = sizeof(v);
+		return signed_order_key((int16_t)be16toh(v));
+	}
+	case FIELD_INT:     size = 4; return signed_order_key(read_int(p));
+	case FIELD_LONG: {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		size = sizeof(v);
+		return signed_order_key((int64_t)be64toh(v));
+	}
+	case FIELD_FLOAT:   size = 4; return float_order_key(p);
+	case FIELD_DOUBLE:  size = 8; return double_order_key(p);
+	default:            size = StreamUtility::decodeVIntSize((int)p[0]); return signed_order_key(read_vlong(p));
+	}
+}
+
+// size of the serialized field at p, or -1 when it would cross the avail bytes
+// (a key that does not match the spec, or a corrupted length)
+static inline int field_size(key_field_type_t type, const char* p, int avail) {
+	int size;
+	switch (type) {
+	case FIELD_BOOLEAN:
+	case FIELD_BYTE:    size = 1; break;
+	case FIELD_SHORT:   size = 2; break;
+	case FIELD_INT:
+	case FIELD_FLOAT:   size = 4; break;
+	case FIELD_LONG:
+	case FIELD_DOUBLE:  size = 8; break;
+	case FIELD_VLONG:
+		if (avail < 1) return -1;
+		size = StreamUtility::decodeVIntSize((int)p[0]);
+		break;
+	default: { // text: a VInt length and the bytes
+		if (avail < 1) return -1;
+		size = StreamUtility::decodeVIntSize((int)p[0]);
+		if (size > avail) return -1;
+		int64_t text_len = read_vlong(p);
+		if (text_len < 0 || text_len > avail - size) return -1;
+		size += (int)text_len;
+	}
+	}
+	return (size <= avail) ? size : -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static int composite_compare(char* key1, int len1, char* key2, int len2) {
+	char *end1 = key1 + len1, *end2 = key2 + len2;
+	for (size_t i = 0; i < g_key_fields.size(); ++i) {
+		const key_field_t &field = g_key_fields[i];
+		int res;
+		int size1 = field_size(field.type, key1, end1 - key1);
+		int size2 = field_size(field.type, key2, end2 - key2);
+		if (size1 < 0 || size2 < 0) {
+			break; // the rest is ordered by its length
+		}
+		if (field.type == FIELD_TEXT) {
+			int skip1 = StreamUtility::decodeVIntSize((int)key1[0]);
+			int skip2 = StreamUtility::decodeVIntSize((int)key2[0]);
+			res = byte_compare_inline(key1 + skip1, size1 - skip1, key2 + skip2, size2 - skip2);
+		}
+		else {
+			int size;
+			res = unsigned_compare(field_order_key(field.type, key1, size), field_order_key(field.type, key2, size));
+		}
+		if (res) {
+			return field.descending ? -res : res;
+		}
+		key1 += size1;
+		key2 += size2;
+	}
+	long rest1 = end1 - key1, rest2 = end2 - key2;
+	return (rest1 > rest2) - (rest1 < rest2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// prefix of the first field only; 0 when the key is too short for it
+static uint64_t composite_prefix(char* key, int len) {
+	const key_field_t &field = g_key_fields[0];
+	int size = field_size(field.type, key, len);
+	if (size < 0) {
+		return 0;
+	}
+	uint64_t prefix;
+	if (field.type == FIELD_TEXT) {
+		int skip = StreamUtility::decodeVIntSize((int)key[0]);
+		prefix = byte_prefix_inline(key + skip, size - skip);
+	}
+	else {
+		prefix = field_order_key(field.type, key, size);
+	}
+	return field.descending ? ~prefix : prefix;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// compare funcs of key types that are not built in, by Java's key type name
+typedef std::map<std::string, std::pair<hadoop_cmp_func, hadoop_prefix_func> > compare_func_registry_t;
+static compare_func_registry_t g_compare_func_registry;
+
+void register_compare_func(const char* java_comparator_type_name, hadoop_cmp_func cmp_func, hadoop_prefix_func prefix_func) {
+	log(lsINFO, "registering compare function for type: '%s' (%s prefix)", java_comparator_type_name, prefix_func ? "with" : "no");
+	g_compare_func_registry[java_comparator_type_name] = std::make_pair(cmp_func, prefix_func ? prefix_func : no_prefix);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void load_compare_func(const char* java_comparator_type_name, const char* lib_path, const char* symbol) {
+	// never closed, since the loaded functions are used until the process ends
+	void *handle = dlopen(lib_path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		log(lsERROR, "error loading comparator library %s: %s", lib_path, dlerror());
+		throw new UdaException("Error loading comparator library");
+	}
+
+	dlerror();
+	hadoop_cmp_func cmp_func = (hadoop_cmp_func)dlsym(handle, symbol);
+	char *error = dlerror();
+	if (error != NULL || !cmp_func) {
+		log(lsERROR, "error loading %s from %s: %s", symbol, lib_path, error ? error : "NULL symbol");
+		throw new UdaException("Error loading compare function");
+	}
+
+	// the prefix func is optional
+	std::string prefix_symbol = std::string(symbol) + "_prefix";
+	hadoop_prefix_func prefix_func = (hadoop_prefix_func)dlsym(handle, prefix_symbol.c_str());
+	dlerror();
+
+	log(lsINFO, "loaded %s from %s", symbol, lib_path);
+	register_compare_func(java_comparator_type_name, cmp_func, prefix_func);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void set_composite_compare_func(const char* java_comparator_type_name, const char* spec) {
+	std::vector<key_field_t> fields;
+	std::string str(spec);
+	size_t pos = 0;
+	while (pos <= str.size()) {
+		size_t end = str.find(',', pos);
+		if (end == std::string::npos) end = str.size();
+
+		// "<type> [asc|desc]"
+		char type_name[32] = "", order[32] = "";
+		std::string token = str.substr(pos, end - pos);
+		int n = sscanf(token.c_str(), "%31s %31s", type_name, order);
+		for (char *c = type_name; *c; ++c) *c = tolower(*c);
+		for (char *c = order; *c; ++c) *c = tolower(*c);
+
+		key_field_t field;
+		int i;
+		for (i = 0; KEY_FIELD_NAMES[i].name && strcmp(KEY_FIELD_NAMES[i].name, type_name); ++i) ;
+		if (n < 1 || !KEY_FIELD_NAMES[i].name || (n == 2 && strcmp(order, "asc") && strcmp(order, "desc"))) {
+			log(lsERROR, "bad field '%s' in composite key spec: '%s'", token.c_str(), spec);
+			throw new UdaException("bad composite key spec");
+		}
+		field.type = KEY_FIELD_NAMES[i].type;
+		field.descending = (n == 2 && strcmp(order, "desc") == 0);
+		fields.push_back(field);
+		pos = end + 1;
+	}
+
+	// the fields are shared by every composite key type name: a different spec would
+	// change the order of the types that were registered before
+	bool same = g_key_fields.empty() || g_key_fields.size() == fields.size();
+	for (size_t i = 0; same && i < g_key_fields.size(); ++i) {
+		same = g_key_fields[i].type == fields[i].type && g_key_fields[i].descending == fields[i].descending;
+	}
+	if (!same) {
+		log(lsERROR, "composite key spec '%s' of %s differs from the one set before", spec, java_comparator_type_name);
+		throw new UdaException("a different composite key spec was set before");
+	}
+	g_key_fields = fields;
+	log(lsINFO, "composite key of %d fields: '%s'", (int)fields.size(), spec);
+	register_compare_func(java_comparator_type_name, composite_compare, composite_prefix);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+KEY_COMPARE_KIND g_key_compare_kind = KEY_COMPARE_GENERIC;
+
+KEY_COMPARE_KIND get_key_compare_kind(const char* java_comparator_type_name) {
+
+	if (g_compare_func_registry.count(java_comparator_type_name)) {
+		return KEY_COMPARE_GENERIC;
+	}
+	else if (str_in_array(java_comparator_type_name, TEXT_COMPARABLE)) {
+		return KEY_COMPARE_TEXT;
+	}
+	else if (str_in_array(java_comparator_type_name, BYTE_COMPARABLE)) {
+		return KEY_COMPARE_BYTE;
+	}
+	else if (str_in_array(java_comparator_type_name, BYTES_COMPARABLE)) {
+		return KEY_COMPARE_BYTES;
+	}
+	else {
+		return KEY_COMPARE_GENERIC;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+hadoop_prefix_func g_prefix_func = no_prefix;
+
+hadoop_prefix_func get_prefix_func(const char* java_comparator_type_name) {
+
+	compare_func_registry_t::iterator it = g_compare_func_registry.find(java_comparator_type_name);
+	if (it != g_compare_func_registry.end()) {
+		return it->second.second;
+	}
+
+	if (str_in_array(java_comparator_type_name, TEXT_COMPARABLE)) {
+		return text_prefix;
+	}
+	else if (str_in_array(java_comparator_type_name, BYTE_COMPARABLE)) {
+		return byte_prefix;
+	}
+	else if (str_in_array(java_comparator_type_name, BYTES_COMPARABLE)) {
+		return bytes_prefix;
+	}
+	else if (str_in_array(java_comparator_type_name, DOUBLE_COMPARABLE)) {
+		return double_prefix;
+	}
+	else if (str_in_array(java_comparator_type_name, FLOAT_COMPARABLE)) {
+		return float_prefix;
+	}
+	else if (str_in_array(java_comparator_type_name, VLONG_COMPARABLE)) {
+		return vlong_prefix;
+	}
+	else if (str_in_array(java_comparator_type_name, ID_COMPARABLE)) {
+		return id_prefix;
+	}
+	else {
+		return no_prefix;
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 hadoop_cmp_func get_compare_func(const char* java_comparator_type_name) {
 
+	compare_func_registry_t::iterator it = g_compare_func_registry.find(java_comparator_type_name);
+	if (it != g_compare_func_registry.end()) {
+		log(lsDEBUG, "using registered compare function");
+		return it->second.first;
+	}
+
 	if (str_in_array(java_comparator_type_name, TEXT_COMPARABLE)) {
 		log(lsDEBUG, "using Text compare function");
 		return text_compare;
@@ -106,6 +627,22 @@ hadoop_cmp_func get_compare_func(const char* java_comparator_type_name) {
 		log(lsDEBUG, "using BytesWritable compare function");
 		return bytes_compare;
 	}
+	else if (str_in_array(java_comparator_type_name, DOUBLE_COMPARABLE)) {
+		log(lsDEBUG, "using DoubleWritable compare function");
+		return double_compare;
+	}
+	else if (str_in_array(java_comparator_type_name, FLOAT_COMPARABLE)) {
+		log(lsDEBUG, "using FloatWritable compare function");
+		return float_compare;
+	}
+	else if (str_in_array(java_comparator_type_name, VLONG_COMPARABLE)) {
+		log(lsDEBUG, "using VInt/VLongWritable compare function");
+		return vlong_compare;
+	}
+	else if (str_in_array(java_comparator_type_name, ID_COMPARABLE)) {
+		log(lsDEBUG, "using ID compare function");
+		return id_compare;
+	}
 	else {
 		log(lsERROR, "using compare function for unsupported type: '%s'", java_comparator_type_name);
 		throw new UdaException("using compare function for unsupported type");
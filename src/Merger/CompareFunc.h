@@ -20,8 +20,13 @@
 #ifndef __COMPARE_FUNC
 #define __COMPARE_FUNC
 
+#include <stdint.h>
+#include <string.h>
 #include "IOUtility.h"
 
+// Matches BytesWritable's definition of LENGTH_BYTES in Java
+const int LENGTH_BYTES = 4;
+
 typedef int (*hadoop_cmp_func)(char* key1, int len1, char* key2, int len2);
 
 // compare function to be used during reducer mergeSort
@@ -30,4 +35,86 @@ extern hadoop_cmp_func g_cmp_func;
 
 hadoop_cmp_func get_compare_func(const char* java_comparator_type_name);
 
+// memcmp-like kernel of the byte compare funcs (for n >= 16): "scalar" (memcmp), "sse42", "avx2"
+// or "auto" - memcmp, which no kernel beats on long keys. NULL when not supported by this build or CPU.
+typedef int (*byte_diff_func)(const char* p1, const char* p2, int n);
+
+byte_diff_func get_byte_diff_func(const char* name);
+
+// the kernel of the compare funcs; "auto" unless set on init_reduce_task
+void select_byte_diff_func(const char* name);
+
+// below this many bytes memcmp is as good as the kernels
+#define SIMD_COMPARE_MIN_LEN 16
+
+// the selected kernel, and whether it is a SIMD kernel. when it is not, the compare calls
+// memcmp directly instead of through the pointer, which could not be inlined
+extern byte_diff_func g_byte_diff_func;
+extern bool g_byte_diff_simd;
+
+inline int byte_compare_inline(const char* key1, int len1, const char* key2, int len2) {
+	int min_len = (len1 < len2) ? len1 : len2;
+	int cmp_res = (g_byte_diff_simd && min_len >= SIMD_COMPARE_MIN_LEN) ? g_byte_diff_func(key1, key2, min_len) : memcmp(key1, key2, min_len);
+	return (cmp_res) ? (cmp_res) : (len1 - len2);
+}
+
+// the compare funcs of the common key types as types, for inlining them into the merge heaps
+// (see SegmentLess in StreamRW.h). any other key type is compared through g_cmp_func
+enum KEY_COMPARE_KIND {KEY_COMPARE_GENERIC, KEY_COMPARE_TEXT, KEY_COMPARE_BYTE, KEY_COMPARE_BYTES};
+
+// set once on init_reduce_task together with g_cmp_func
+extern KEY_COMPARE_KIND g_key_compare_kind;
+
+KEY_COMPARE_KIND get_key_compare_kind(const char* java_comparator_type_name);
+
+struct GenericKeyCompare {
+	static inline int compare(char* key1, int len1, char* key2, int len2) {
+		return g_cmp_func(key1, len1, key2, len2);
+	}
+};
+
+struct ByteKeyCompare {
+	static inline int compare(char* key1, int len1, char* key2, int len2) {
+		return byte_compare_inline(key1, len1, key2, len2);
+	}
+};
+
+struct TextKeyCompare {
+	static inline int compare(char* key1, int len1, char* key2, int len2) {
+		int k1_skip_bytes = StreamUtility::decodeVIntSize((int)(key1[0]));
+		int k2_skip_bytes = StreamUtility::decodeVIntSize((int)(key2[0]));
+		return byte_compare_inline(key1 + k1_skip_bytes, len1 - k1_skip_bytes, key2 + k2_skip_bytes, len2 - k2_skip_bytes);
+	}
+};
+
+struct BytesKeyCompare {
+	static inline int compare(char* key1, int len1, char* key2, int len2) {
+		return byte_compare_inline(key1 + LENGTH_BYTES, len1 - LENGTH_BYTES, key2 + LENGTH_BYTES, len2 - LENGTH_BYTES);
+	}
+};
+
+// normalized 8-byte prefix of a serialized key, order preserving for its compare func:
+// prefix(k1) < prefix(k2) implies g_cmp_func(k1, k2) < 0; on ties g_cmp_func decides
+typedef uint64_t (*hadoop_prefix_func)(char* key, int len);
+
+// set once on init_reduce_task together with g_cmp_func
+extern hadoop_prefix_func g_prefix_func;
+
+hadoop_prefix_func get_prefix_func(const char* java_comparator_type_name);
+
+// registered compare funcs take precedence over the built-in ones of the same type;
+// prefix_func may be NULL
+void register_compare_func(const char* java_comparator_type_name, hadoop_cmp_func cmp_func, hadoop_prefix_func prefix_func);
+
+// registers a user compare func from a shared object: symbol is a hadoop_cmp_func,
+// and "<symbol>_prefix" is an optional hadoop_prefix_func
+void load_compare_func(const char* java_comparator_type_name, const char* lib_path, const char* symbol);
+
+// registers a compare func for keys that are a concatenation of serialized fields,
+// spec is comma separated "<type> [asc|desc]" with types
+// boolean, byte, short, int, long, float, double, vint, vlong, text - e.g. "int asc, text desc";
+// the fields are one per process: a spec that differs from the one set before throws.
+// Keys that end within a field are ordered by the length of what is left of them
+void set_composite_compare_func(const char* java_comparator_type_name, const char* spec);
+
 #endif
@@ -48,6 +48,15 @@ public:
     pthread_mutex_t      lock;
     netlev_thread_t      decompress_thread;
 
+    // block API of the codec, used for compressing the local LPQ spill files.
+    // both calls are thread safe; compressBlock needs getCompressWorkMemSize() bytes of work_mem
+    virtual size_t getMaxCompressedLength(size_t uncompressed_len) = 0;
+    virtual size_t getCompressWorkMemSize() {return 0;}
+    virtual size_t compressBlock(const char* uncompressed_buff, size_t uncompressed_buff_len, char* compressed_buff, size_t compressed_buff_len, void *work_mem) = 0;
+    virtual void decompressBlock(const char* compressed_buff, char* uncompressed_buff, size_t compressed_buff_len, size_t uncompressed_buff_len, decompressRetData_t* retObj) {
+    	decompress(compressed_buff, uncompressed_buff, compressed_buff_len, uncompressed_buff_len, 0, retObj);
+    }
+
 
 
 protected:
@@ -0,0 +1,168 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+
+#include "KeySketch.h"
+#include "IOUtility.h"
+#include "UdaBridge.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+HotKeySketch::HotKeySketch(int _capacity, int _sample_every) :
+	capacity(_capacity), sample_every(max(1, _sample_every)), countdown(1), total_count(0), total_bytes(0)
+{
+	counters.reserve(capacity);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/*static*/ HotKeySketch* HotKeySketch::create()
+{
+	string value = UdaBridge_invoke_getConfData_callback("mapred.rdma.merge.hotkeys", "0");
+	int capacity = atoi(value.c_str());
+	if (capacity <= 0) {
+		return NULL;
+	}
+	value = UdaBridge_invoke_getConfData_callback("mapred.rdma.merge.hotkeys.sample", HOT_KEYS_SAMPLE_EVERY);
+	return new HotKeySketch(capacity, atoi(value.c_str()));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void HotKeySketch::sample(const char *key, int32_t key_len, int64_t record_bytes)
+{
+	++total_count;
+	total_bytes += record_bytes;
+
+	string k(key, key_len);
+	map<string, size_t>::iterator it = index.find(k);
+	if (it != index.end()) {
+		counters[it->second].count++;
+		counters[it->second].bytes += record_bytes;
+		return;
+	}
+
+	if (counters.size() < capacity) {
+		key_counter_t c = {k, 1, 0, record_bytes};
+		index[k] = counters.size();
+		counters.push_back(c);
+		return;
+	}
+
+	// the new key takes over the smallest counter
+	size_t min_idx = 0;
+	for (size_t i = 1; i < counters.size(); ++i) {
+		if (counters[i].count < counters[min_idx].count) min_idx = i;
+	}
+	key_counter_t &c = counters[min_idx];
+	index.erase(c.key);
+	c.error = c.count;
+	c.count++;
+	c.bytes = record_bytes;
+	c.key.swap(k);
+	index[c.key] = min_idx;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/*static*/ bool HotKeySketch::count_greater(const key_counter_t &a, const key_counter_t &b)
+{
+	return a.count > b.count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void HotKeySketch::merge(const HotKeySketch &other)
+{
+	total_count += other.total_count;
+	total_bytes += other.total_bytes;
+
+	// the key ranges are disjoint, so no key has a counter in both
+	vector<key_counter_t> all(counters);
+	all.insert(all.end(), other.counters.begin(), other.counters.end());
+	sort(all.begin(), all.end(), count_greater);
+	if (all.size() > capacity) {
+		all.resize(capacity);
+	}
+
+	counters.swap(all);
+	index.clear();
+	for (size_t i = 0; i < counters.size(); ++i) {
+		index[counters[i].key] = i;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// the key as text when it is printable, otherwise as hex; long keys are cut
+static string printable_key(const string &key)
+{
+	static const size_t MAX_SHOWN = 48;
+	size_t n = min(key.length(), MAX_SHOWN);
+	bool text = true;
+	for (size_t i = 0; i < n && text; ++i) {
+		text = isprint((unsigned char)key[i]);
+	}
+
+	string s;
+	char hex[4];
+	for (size_t i = 0; i < n; ++i) {
+		if (text) {
+			s += key[i];
+		}
+		else {
+			snprintf(hex, sizeof(hex), "%02x", (unsigned char)key[i]);
+			s += hex;
+		}
+	}
+	if (n < key.length()) {
+		s += "...";
+	}
+	return s;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void HotKeySketch::report(const char *reduce_task_id) const
+{
+	if (!total_count) {
+		return;
+	}
+	vector<key_counter_t> top(counters);
+	sort(top.begin(), top.end(), count_greater);
+
+	log(lsINFO, "hot keys of %s: %lld records (%lld bytes), 1 of %d sampled",
+			reduce_task_id, (long long)total_count * sample_every, (long long)total_bytes * sample_every, sample_every);
+	for (size_t i = 0; i < top.size() && i < HOT_KEYS_REPORTED; ++i) {
+		const key_counter_t &c = top[i];
+		if ((c.count - c.error) * (int64_t)capacity <= total_count) {
+			continue; // not surely above total / capacity: might be any key that got the counter last
+		}
+		log(lsINFO, "hot key #%d: %lld records (%.1f%%, over by at most %lld), %lld bytes: %s",
+				(int)i + 1, (long long)c.count * sample_every, 100.0 * c.count / total_count,
+				(long long)c.error * sample_every, (long long)c.bytes * sample_every, printable_key(c.key).c_str());
+	}
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -0,0 +1,86 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#ifndef KEY_SKETCH_H
+#define KEY_SKETCH_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#define HOT_KEYS_SAMPLE_EVERY "16" // records per sampled record
+#define HOT_KEYS_REPORTED     (10)
+
+/*
+ * SpaceSaving summary of the most frequent keys of a merge, for spotting skewed
+ * reduce inputs.  Only every sample_every-th record is counted; the reported
+ * counts are scaled back.  A key's count is over-estimated by at most its error,
+ * its bytes are those seen since it got its counter.
+ */
+class HotKeySketch
+{
+public:
+	HotKeySketch(int capacity, int sample_every);
+
+	// NULL unless mapred.rdma.merge.hotkeys (the number of tracked keys) is set
+	static HotKeySketch* create();
+
+	inline void add(const char *key, int32_t key_len, int64_t record_bytes) {
+		if (--countdown) return;
+		countdown = sample_every;
+		sample(key, key_len, record_bytes);
+	}
+
+	// adds the summary of a disjoint key range (see RangeMerger)
+	void merge(const HotKeySketch &other);
+
+	// logs the top keys, which also sends them to Java's log
+	void report(const char *reduce_task_id) const;
+
+private:
+	typedef struct key_counter {
+		std::string key;
+		int64_t     count;
+		int64_t     error; // the count of the key whose counter this one took over
+		int64_t     bytes;
+	} key_counter_t;
+
+	void sample(const char *key, int32_t key_len, int64_t record_bytes);
+	static bool count_greater(const key_counter_t &a, const key_counter_t &b);
+
+	const size_t                    capacity;
+	const int                       sample_every;
+	int                             countdown;
+	int64_t                         total_count; // sampled records
+	int64_t                         total_bytes;
+	std::vector<key_counter_t>      counters;
+	std::map<std::string, size_t>   index; // key -> its counter
+};
+
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -67,7 +67,8 @@ static const char* DECOMP_PARAM = "io.compression.codec.lzo.decompressor";
 static const int NUM_DECOMP_FUNCS = sizeof(decompressorFuncs) /sizeof(decompressorFuncs[0]); //28;
 
 
-LzoDecompressor::LzoDecompressor(int port, reduce_task_t* reduce_task):DecompressorWrapper (port, reduce_task), liblzo2(NULL), decompressor_func_ptr(NULL), lzo_loaded(false){
+LzoDecompressor::LzoDecompressor(int port, reduce_task_t* reduce_task):DecompressorWrapper (port, reduce_task), liblzo2(NULL), decompressor_func_ptr(NULL),
+		spill_compressor_func_ptr(NULL), spill_decompressor_func_ptr(NULL), lzo_loaded(false){
 	log(lsDEBUG,"LzoDecompressor constractor - numOfDecompressFuncs=%d", NUM_DECOMP_FUNCS);
 	initDecompress();
 }
@@ -112,6 +113,9 @@ void LzoDecompressor::init(){
 	}
 
 	loadDecompressorFunc();
+
+	spill_compressor_func_ptr = (lzo_compress_t) loadSymbolWrapper(liblzo2, "lzo1x_1_compress");
+	spill_decompressor_func_ptr = (lzo_decompress_t) loadSymbolWrapper(liblzo2, "lzo1x_decompress_safe");
 }
 
 /**
@@ -148,6 +152,39 @@ void LzoDecompressor::decompress
 	}
 }
 
+size_t LzoDecompressor::getMaxCompressedLength(size_t uncompressed_len){
+	return uncompressed_len + uncompressed_len / 16 + 64 + 3; // LZO1X worst case expansion
+}
+
+size_t LzoDecompressor::getCompressWorkMemSize(){
+	return LZO1X_1_MEM_COMPRESS;
+}
+
+size_t LzoDecompressor::compressBlock
+(const char* uncompressed_buff, size_t uncompressed_buff_len, char* compressed_buff, size_t compressed_buff_len, void *work_mem){
+
+	lzo_uint comp_len = compressed_buff_len;
+	int rv = spill_compressor_func_ptr((lzo_bytep)uncompressed_buff, (lzo_uint)uncompressed_buff_len, (lzo_bytep)compressed_buff, &comp_len, work_mem);
+	if (rv != LZO_E_OK) {
+		log(lsERROR,"Error=%d in lzo compress function ", rv);
+		throw new UdaException("Error in lzo compress function");
+	}
+	return comp_len;
+}
+
+void LzoDecompressor::decompressBlock
+(const char* compressed_buff, char* uncompressed_buff, size_t compressed_buff_len, size_t uncompressed_buff_len, decompressRetData_t* retObj){
+
+	lzo_uint uncomp_len = uncompressed_buff_len;
+	int rv = spill_decompressor_func_ptr((lzo_bytep)compressed_buff, (lzo_uint)compressed_buff_len,(lzo_bytep)uncompressed_buff, &uncomp_len,NULL);
+	if (rv != LZO_E_OK) {
+		log(lsERROR,"Error=%d in lzo spill decompress function ", rv);
+		throw new UdaException("Error in lzo spill decompress function");
+	}
+	retObj->num_compressed_bytes=compressed_buff_len;
+	retObj->num_uncompressed_bytes=uncomp_len;
+}
+
 void LzoDecompressor::get_next_block_length(char* buf, decompressRetData_t* retObj){
 
 	uint32_t *tmp = (uint32_t*)buf;
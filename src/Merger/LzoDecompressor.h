@@ -37,6 +37,12 @@ public:
 	LzoDecompressor(int port, reduce_task_t* reduce_task);
 	virtual ~LzoDecompressor();
 
+	// spill blocks are always LZO1X, regardless of the configured shuffle decompressor
+	size_t getMaxCompressedLength(size_t uncompressed_len);
+	size_t getCompressWorkMemSize();
+	size_t compressBlock(const char* uncompressed_buff, size_t uncompressed_buff_len, char* compressed_buff, size_t compressed_buff_len, void *work_mem);
+	void decompressBlock(const char* compressed_buff, char* uncompressed_buff, size_t compressed_buff_len, size_t uncompressed_buff_len, decompressRetData_t* retObj);
+
 private:
 
 	void init();
@@ -51,6 +57,8 @@ private:
 
 	void *liblzo2;
 	lzo_decompress_t decompressor_func_ptr;
+	lzo_compress_t   spill_compressor_func_ptr;
+	lzo_decompress_t spill_decompressor_func_ptr;
 	bool lzo_loaded ;
 };
 
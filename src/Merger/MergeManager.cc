@@ -21,12 +21,20 @@
 #include <stdlib.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
 #include "MergeQueue.h"
 #include "MergeManager.h"
+#include "SortedRun.h"
 #include "StreamRW.h"
+#include "RangeMerger.h"
+#include "MergePlanner.h"
 #include "reducer.h"
+#include "DecompressorWrapper.h"
 #include "IOUtility.h"
 #include "C2JNexus.h"
+#include "Crc32.h"
 #include "UdaBridge.h"
 #include "AIOHandler.h"
 #include "bullseye.h"
@@ -106,6 +114,15 @@ void *merge_do_fetching_phase (reduce_task_t *task, SegmentMergeQueue *merge_que
 				== manager->mops_in_queue.end()) {
 
 				manager->mops_in_queue.insert(mop->mop_id);
+				// the sorted run sizes its memory by the records that the fetch thread indexed
+				RecordIndex *rec_index = mop->mop_bufs[mop->staging_mem_idx]->rec_index;
+				if (task->isCompressionOff() && mop->fetched_len_rdma >= mop->total_len_rdma && rec_index) {
+					manager->resident_bytes += mop->total_len_rdma;
+					manager->resident_records += rec_index->size();
+				}
+				else {
+					manager->all_resident = false;
+				}
 				Segment *segment = new Segment(mop);
 
 				if (task->isCompressionOff()){
@@ -152,30 +169,83 @@ void *merge_do_fetching_phase (reduce_task_t *task, SegmentMergeQueue *merge_que
     return NULL;
 }
 
-void *merge_do_merging_phase (reduce_task_t *task, SegmentMergeQueue *merge_queue)
-{
-	/* merging phase */
-	JNIEnv *mergerJniEnv = UdaBridge_threadGetEnv();
+// ring of staging buffers: the merge thread fills free buffers, while the hand-off thread
+// passes the ready ones to Java (which blocks until Java took the data)
+typedef struct staging_ring {
+	concurrent_queue<mem_desc_t*>  free_bufs;
+	concurrent_queue<mem_desc_t*>  ready_bufs; // NULL marks end of data
+} staging_ring_t;
 
-	// register our staging_buf as DirectByteBuffer for sharing with Java
-	mem_desc_t  *desc = merge_queue->staging_bufs[0];  // we only need 1 staging_bufs: TODO: remove the array
-	jobject jbuf = UdaBridge_registerDirectByteBuffer(mergerJniEnv, desc->buff, desc->buf_len);
-	log(lsDEBUG, "GOT: desc=%p, jbuf=%p, address=%p, capacity=%d", desc, jbuf, desc->buff, desc->buf_len);
+static void *java_handoff_start (void *context) throw (UdaException*)
+{
+	staging_ring_t *ring = (staging_ring_t*) context;
+	JNIEnv *handoffJniEnv = UdaBridge_threadGetEnv();
+	std::map<mem_desc_t*, jobject> jbufs; // register each staging buffer once as DirectByteBuffer
+
+	mem_desc_t *desc;
+	for (ring->ready_bufs.wait_and_pop(desc); desc; ring->ready_bufs.wait_and_pop(desc)) {
+		jobject &jbuf = jbufs[desc];
+		if (!jbuf) {
+			jbuf = UdaBridge_registerDirectByteBuffer(handoffJniEnv, desc->buff, desc->buf_len);
+			log(lsDEBUG, "GOT: desc=%p, jbuf=%p, address=%p, capacity=%d", desc, jbuf, desc->buff, desc->buf_len);
+		}
+		log(lsDEBUG, "MERGER: invoking java callback: desc=%p, desc->jbuf=%p, address=%p, capacity=%d act_len=%d", desc, jbuf, desc->buff, desc->buf_len, desc->act_len);
+		UdaBridge_invoke_dataFromUda_callback(handoffJniEnv, jbuf, desc->act_len);
+		ring->free_bufs.push(desc);
+	}
 
+	for (std::map<mem_desc_t*, jobject>::iterator it = jbufs.begin(); it != jbufs.end(); ++it) {
+		log(lsDEBUG, "invoking DeleteWeakGlobalRef: desc=%p, jbuf=%p", it->first, it->second);
+		handoffJniEnv->DeleteWeakGlobalRef((jweak)it->second);
+	}
+	return NULL;
+}
 
-	bool b = false;
-	while (!task->merge_thread.stop && !b) {
+// ends the hand-off thread before its ring goes away - also when the merge throws
+class staging_ring_guard
+{
+public:
+	staging_ring_guard(staging_ring_t *_ring, pthread_t _thread) : ring(_ring), thread(_thread) {}
+	~staging_ring_guard() {
+		ring->ready_bufs.push(NULL);
+		pthread_join(thread, NULL);
+	}
+private:
+	staging_ring_t *ring;
+	pthread_t       thread;
+};
 
-		log(lsDEBUG, "calling write_kv_to_mem desc->buf_len=%d", desc->buf_len);
-		b = write_kv_to_mem(merge_queue, desc->buff, desc->buf_len, desc->act_len);
+void *merge_do_merging_phase (reduce_task_t *task, SegmentMergeQueue *merge_queue)
+{
+	/* merging phase */
+	HotKeySketch *sketch = HotKeySketch::create();
+	merge_queue->key_sketch = sketch;
 
-    	log(lsDEBUG, "MERGER: invoking java callback: desc=%p, desc->jbuf=%p, address=%p, capacity=%d act_len=%d", desc, jbuf, desc->buff, desc->buf_len, desc->act_len);
-		UdaBridge_invoke_dataFromUda_callback(mergerJniEnv, jbuf, desc->act_len);
+	staging_ring_t ring;
+	for (int i = 0; i < NUM_STAGE_MEM; ++i) {
+		ring.free_bufs.push(merge_queue->staging_bufs[i]);
 	}
+	{
+		pthread_t handoff_thread;
+		uda_thread_create(&handoff_thread, NULL, java_handoff_start, &ring);
+		staging_ring_guard handoff(&ring, handoff_thread);
+
+		bool b = false;
+		while (!task->merge_thread.stop && !b) {
+			mem_desc_t *desc;
+			ring.free_bufs.wait_and_pop(desc); // Java is consuming the other buffers meanwhile
+
+			log(lsDEBUG, "calling write_kv_to_mem desc->buf_len=%d", desc->buf_len);
+			b = write_kv_to_mem(merge_queue, desc->buff, desc->buf_len, desc->act_len);
+			ring.ready_bufs.push(desc);
+		}
+	} // Java got all the data
 
-	log(lsDEBUG, "invoking DeleteWeakGlobalRef: desc=%p, jbuf=%p, address=%p, capacity=%d", desc, jbuf, desc->buff, desc->buf_len);
-	mergerJniEnv->DeleteWeakGlobalRef((jweak)jbuf);
-	log(lsDEBUG, "After DeleteWeakGlobalRef");
+	if (sketch) {
+		sketch->report(task->reduce_task_id);
+		merge_queue->key_sketch = NULL;
+		delete sketch;
+	}
 
 	log(lsINFO, "----- merger thread completed ------");
     return NULL;
@@ -186,6 +256,14 @@ void *merge_online (reduce_task_t *task)
 	log(lsINFO, "Merge online"); 
 	merge_do_fetching_phase(task, task->merge_man->merge_queue, task->num_maps);
 
+	// small inputs that were fetched whole: one sort instead of a k-way merge
+	MergeManager *manager = task->merge_man;
+	if (manager->all_resident && manager->resident_bytes <= manager->sort_resident_max_bytes &&
+		manager->resident_records <= manager->sort_resident_max_records &&
+		manager->merge_queue->size() > 1) {
+		manager->merge_queue->insert(new SortedRunSegment(task, manager->merge_queue, manager->resident_records));
+	}
+
 	log(lsDEBUG, "Enter into merging phase");
 	merge_do_merging_phase(task, task->merge_man->merge_queue);
 	log(lsDEBUG, "merge thread exit");
@@ -217,7 +295,7 @@ void MergeManager::fetch_lpqs (){
 		local_counter %= task->local_dirs.size();
 		const string & dir = task->local_dirs[local_counter]; //just ref - no copy
 		sprintf(temp_file, "%s/uda.%s.lpq-%03d", dir.c_str(), task->reduce_task_id, i);
-		SegmentMergeQueue *lpq = new SegmentMergeQueue(num_to_fetch, NULL, temp_file, resetBaseSegment);
+		SegmentMergeQueue *lpq = createSegmentMergeQueue(num_to_fetch, NULL, temp_file, resetBaseSegment);
 
 		log(lsINFO, "   === [F %d/%d] wait on reserve quota for LPQ with %d segments ", i, this->num_lpqs, num_to_fetch);
 		pendingMerge->wait_and_reserve();
@@ -237,6 +315,90 @@ void MergeManager::fetch_lpqs (){
 	return NULL;
 }
 
+// intermediate passes of the merge plan: merges the smallest spills (as measured on disk)
+// into one, until the RPQ can take all of them at once
+void MergeManager::merge_spill_passes(std::vector<std::string> &spills, std::vector<SpillKeyIndex*> &indexes)
+{
+	for (int pass = 0; (int)spills.size() > spill_fan_in; ++pass) {
+		int factor = MergePlan::pass_factor(spill_fan_in, pass, spills.size());
+
+		std::vector<std::pair<int64_t, int> > sizes(spills.size());
+		for (size_t i = 0; i < spills.size(); ++i) {
+			struct stat st;
+			sizes[i] = std::make_pair(stat(spills[i].c_str(), &st) ? 0 : (int64_t)st.st_size, (int)i);
+		}
+		std::partial_sort(sizes.begin(), sizes.begin() + factor, sizes.end());
+
+		char temp_file[PATH_MAX];
+		const string & dir = task->local_dirs[pass % task->local_dirs.size()];
+		sprintf(temp_file, "%s/uda.%s.ipq-%03d", dir.c_str(), task->reduce_task_id, pass);
+
+		SegmentMergeQueue *queue = createSegmentMergeQueue(factor);
+		std::vector<bool> merged(spills.size(), false);
+		int64_t pass_bytes = 0;
+		for (int j = 0; j < factor; ++j) {
+			int i = sizes[j].second;
+			merged[i] = true;
+			pass_bytes += sizes[j].first;
+			queue->insert(new SuperSegment(task, spills[i], spill_codec)); // removes the file once merged
+		}
+		log(lsINFO, "[P %d] merging %d smallest out of %d spills (%lld bytes) into: %s", pass, factor, (int)spills.size(), (long long)pass_bytes, temp_file);
+
+		SpillKeyIndex *index = (num_rpq_threads > 1) ? new SpillKeyIndex(RPQ_KEY_INDEX_INTERVAL) : NULL;
+		int64_t total_write;
+		write_kv_to_file(queue, temp_file, total_write, index, spill_codec, spill_aio);
+		delete queue;
+		log(lsINFO, "[P %d] after merge: total_write=%lld", pass, (long long)total_write);
+
+		size_t kept = 0;
+		for (size_t i = 0; i < spills.size(); ++i) {
+			if (merged[i]) {
+				delete indexes[i];
+				continue;
+			}
+			spills[kept] = spills[i];
+			indexes[kept] = indexes[i];
+			++kept;
+		}
+		spills.resize(kept);
+		indexes.resize(kept);
+		spills.push_back(temp_file);
+		indexes.push_back(index);
+	}
+}
+
+/*static*/void *MergeManager::lpq_merger_start (void *context) throw (UdaException*){
+	MergeManager *_this = (MergeManager*)context;
+	_this->merge_lpqs();
+	return NULL;
+}
+
+// run by each LPQ merge thread: merges LPQs to their spill files, as long as there are LPQs left
+void MergeManager::merge_lpqs ()
+{
+	bool b = true;
+	int64_t total_write;
+
+	while (true) {
+		pthread_mutex_lock(&lpq_merge_lock);
+		int i = next_lpq_to_merge++;
+		pthread_mutex_unlock(&lpq_merge_lock);
+		if (i >= this->num_lpqs) break;
+
+		log(lsINFO, "[M %d] ====== waiting on pop for LPQ", i);
+		pendingMerge->wait_and_pop_without_dereserve(merged_lpqs[i]);
+		log(lsINFO, "[M %d]    === after  pop - going to merge LPQ using file: %s", i, merged_lpqs[i]->filename.c_str());
+
+		spill_indexes[i] = (num_rpq_threads > 1) ? new SpillKeyIndex(RPQ_KEY_INDEX_INTERVAL) : NULL;
+		b = write_kv_to_file(merged_lpqs[i], merged_lpqs[i]->filename.c_str(), total_write, spill_indexes[i], spill_codec, spill_aio);
+		log(lsINFO, "[M %d]   === after merge of LPQ b=%d, total_write=%lld; clearing and de-reserving...", i, (int)b, (long long)total_write);
+		merged_lpqs[i]->clear(); // sanity return RDMA buffers to pool (actually the segments were already released)
+
+		pendingMerge->dereserve();
+		log(lsINFO, "[M %d]    === after dereserve", i);
+	}
+}
+
 void *MergeManager::merge_hybrid ()
 {
 	if (task->num_maps < this->num_lpqs) return merge_online(task);
@@ -244,43 +406,80 @@ void *MergeManager::merge_hybrid ()
 	pthread_t thr;
 	uda_thread_create(&thr, NULL, lpq_fetcher_start, this);
 
-	SegmentMergeQueue* merge_lpq[this->num_lpqs];
-	bool b = true;
-	int32_t total_write;
+	// the input client is created after us, hence the codec is only known here
+	spill_codec = (compress_spills && task->isCompressionOn()) ? dynamic_cast<DecompressorWrapper*>(task->client) : NULL;
+	log(lsINFO, "LPQ spill files will be written %s", spill_codec ? "compressed" : "uncompressed");
+
+	if (use_spill_aio) {
+		// every LPQ merge thread has at most NUM_STAGE_MEM writes in flight
+		int max_events = max(MERGE_AIOHANDLER_CTX_MAXEVENTS, 2 * NUM_STAGE_MEM * num_lpq_merge_threads);
+		timespec timeout;
+		timeout.tv_nsec = MERGE_AIOHANDLER_TIMEOUT_IN_NSEC;
+		timeout.tv_sec = 0;
+		spill_aio = new AIOHandler(AioFileOutStream::write_completion_handler, max_events, MERGE_AIOHANDLER_MIN_NR, MERGE_AIOHANDLER_NR, &timeout);
+		spill_aio->start();
+	}
 
-	for (int i = 0; i < this->num_lpqs; ++i) {
-		log(lsINFO, "[M %d] ====== waiting on pop for LPQ", i);
-		pendingMerge->wait_and_pop_without_dereserve(merge_lpq[i]);
-		log(lsINFO, "[M %d]    === after  pop - going to merge LPQ using file: %s", i, merge_lpq[i]->filename.c_str());
+	merged_lpqs.resize(this->num_lpqs, NULL);
+	spill_indexes.resize(this->num_lpqs, NULL);
+	next_lpq_to_merge = 0;
 
-		b = write_kv_to_file(merge_lpq[i], merge_lpq[i]->filename.c_str(), total_write);
-		log(lsINFO, "[M %d]   === after merge of LPQ b=%d, total_write=%d; clearing and de-reserving...", i, (int)b, total_write);
-		merge_lpq[i]->core_queue.clear(); // sanity return RDMA buffers to pool (actually the segments were already released)
+	// this thread is one of the LPQ merge threads
+	std::vector<pthread_t> lpq_mergers(num_lpq_merge_threads - 1);
+	for (size_t i = 0; i < lpq_mergers.size(); ++i) {
+		uda_thread_create(&lpq_mergers[i], NULL, lpq_merger_start, this);
+	}
+	merge_lpqs();
+	for (size_t i = 0; i < lpq_mergers.size(); ++i) {
+		pthread_join(lpq_mergers[i], NULL);
+	}
 
-		pendingMerge->dereserve();
-		log(lsINFO, "[M %d]    === after dereserve", i);
+	std::vector<std::string> spills(this->num_lpqs);
+	for (int i = 0; i < this->num_lpqs ; ++i)
+	{
+		spills[i] = merged_lpqs[i]->filename;
+		delete merged_lpqs[i];
 	}
 
 	log(lsINFO, "=== MM ALL LPQs entirely completed.  Building RPQ...");
 	// turn compression off in case it was on, since currently RPQ is always without compression
 	compressionType _comp_alg = task->resetCompression();
-	for (int i = 0; i < this->num_lpqs ; ++i)
-	{
-		log(lsINFO, "[M %d] === inserting LPQ to RPQ using file: %s", i, merge_lpq[i]->filename.c_str());
-		task->merge_man->merge_queue->insert(new SuperSegment(task, merge_lpq[i]->filename.c_str()));
-		log(lsINFO, "[M %d] === after insertion of LPQ into RPQ", i);
+	merge_spill_passes(spills, spill_indexes);
+
+	if (spill_aio) {
+		delete spill_aio; // all spill writes were completed
+		spill_aio = NULL;
 	}
 
-	//TODO: probably can be joined with previous loop
-	for (int i = 0; i < this->num_lpqs ; ++i)
-	{
-		delete merge_lpq[i];
+	if (num_rpq_threads > 1) {
+		RangeMerger range_merger(task, num_rpq_threads, spill_codec);
+		for (size_t i = 0; i < spills.size() ; ++i)
+		{
+			range_merger.add_spill(spills[i], spill_indexes[i]);
+		}
+
+		log(lsINFO, "MM RPQ phase: going to merge all LPQs using %d threads...", num_rpq_threads);
+		range_merger.merge();
+		log(lsINFO, "MM after ALL merge");
+
+		for (size_t i = 0; i < spill_indexes.size() ; ++i)
+		{
+			delete spill_indexes[i];
+		}
 	}
+	else {
+		for (size_t i = 0; i < spills.size() ; ++i)
+		{
+			log(lsINFO, "[M %d] === inserting LPQ to RPQ using file: %s", (int)i, spills[i].c_str());
+			task->merge_man->merge_queue->insert(new SuperSegment(task, spills[i], spill_codec));
+			log(lsINFO, "[M %d] === after insertion of LPQ into RPQ", (int)i);
+		}
 
-	log(lsINFO, "MM RPQ phase: going to merge all LPQs...");
-	merge_do_merging_phase(task, this->merge_queue);
-	log(lsINFO, "MM after ALL merge");
-	// merge_queue will be deleted in DTOR of MergeManager
+		log(lsINFO, "MM RPQ phase: going to merge all LPQs...");
+		merge_do_merging_phase(task, this->merge_queue);
+		log(lsINFO, "MM after ALL merge");
+		// merge_queue will be deleted in DTOR of MergeManager
+	}
 
 	task->setCompressionType(_comp_alg);
 	log(lsINFO, "MM compression state was restored");
@@ -314,7 +513,7 @@ void *MergeManager::merge_thread_main (void *context) throw (UdaException*)
 }
 
 /* The following is for MergeManager */
-MergeManager::MergeManager(int threads, int online, struct reduce_task *task, int _num_lpqs) :
+MergeManager::MergeManager(int threads, int online, struct reduce_task *task, int _num_lpqs, int _spill_fan_in) :
 		num_lpqs(_num_lpqs),
 		num_mofs_in_lpq(task->num_maps/num_lpqs),
 		max_mofs_in_lpqs(num_mofs_in_lpq+1),
@@ -330,9 +529,40 @@ MergeManager::MergeManager(int threads, int online, struct reduce_task *task, in
     this->progress_count = 0;
     this->merge_queue = NULL;
 
-    string value = UdaBridge_invoke_getConfData_callback("mapred.rdma.num.parallel.lpqs", "0");
-    int num_parallel_lpqs = atoi(value.c_str());
-    this->num_parallel_lpqs = (num_parallel_lpqs < MIN_PARALLEL_LPQS) ? MIN_PARALLEL_LPQS : num_parallel_lpqs;
+    this->spill_fan_in = max(2, _spill_fan_in);
+    string value;
+
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.rpq.merge.threads", "1");
+    this->num_rpq_threads = max(1, atoi(value.c_str()));
+
+    this->num_lpq_merge_threads = min(get_num_lpq_merge_threads(), num_lpqs);
+    this->num_parallel_lpqs = get_num_parallel_lpqs(this->num_lpq_merge_threads);
+    this->next_lpq_to_merge = 0;
+    pthread_mutex_init(&this->lpq_merge_lock, NULL);
+
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.spill.compression", "0");
+    this->compress_spills = atoi(value.c_str()) != 0;
+    this->spill_codec = NULL;
+
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.spill.aio", "1");
+    this->use_spill_aio = atoi(value.c_str()) != 0;
+    this->spill_aio = NULL;
+
+    // the compressed path decompresses into a cyclic buffer, record by record
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.merge.sort.max.bytes", SORT_RESIDENT_MAX_BYTES);
+    this->sort_resident_max_bytes = atoll(value.c_str());
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.merge.sort.max.records", SORT_RESIDENT_MAX_RECORDS);
+    this->sort_resident_max_records = atoll(value.c_str());
+    this->all_resident = true;
+    this->resident_bytes = 0;
+    this->resident_records = 0;
+
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.merge.record.index", "1");
+    this->index_records = atoi(value.c_str()) != 0 && task->isCompressionOff();
+
+    // the checksum covers the map output as fetched, which we see in place only without compression
+    value = UdaBridge_invoke_getConfData_callback("mapred.rdma.shuffle.checksum", "0");
+    this->verify_checksums = atoi(value.c_str()) != 0 && task->isCompressionOff();
 
     num_kv_bufs = this->online == 2 ? // 2 is hybrid_merge
 			this->max_mofs_in_lpqs * this->num_parallel_lpqs : this->task->num_maps;
@@ -343,13 +573,13 @@ MergeManager::MergeManager(int threads, int online, struct reduce_task *task, in
     if (online) {    
 
     	if (online == 1) {
-    		merge_queue = new SegmentMergeQueue(task->num_maps);
+    		merge_queue = createSegmentMergeQueue(task->num_maps);
     	}
     	else { //online == 2
     		log(lsINFO, "hybrid merge will use %d lpqs", num_lpqs);
-    		merge_queue = new SegmentMergeQueue(num_lpqs);
-    		log(lsINFO, "====== num_maps=%d; num_lpqs=%d; num_mofs_in_lpq=%d, max_mofs_in_lpqs=%d, num_regular_lpqs=%d, num_kv_bufs=%d, this->num_parallel_lpqs=%d",
-    				task->num_maps, num_lpqs, num_mofs_in_lpq, max_mofs_in_lpqs, num_regular_lpqs, num_kv_bufs, this->num_parallel_lpqs);
+    		merge_queue = createSegmentMergeQueue(num_lpqs);
+    		log(lsINFO, "====== num_maps=%d; num_lpqs=%d; num_mofs_in_lpq=%d, max_mofs_in_lpqs=%d, num_regular_lpqs=%d, num_kv_bufs=%d, this->num_parallel_lpqs=%d, num_lpq_merge_threads=%d",
+    				task->num_maps, num_lpqs, num_mofs_in_lpq, max_mofs_in_lpqs, num_regular_lpqs, num_kv_bufs, this->num_parallel_lpqs, num_lpq_merge_threads);
     	}
 
         /* get staging mem from memory_pool*/
@@ -364,6 +594,21 @@ MergeManager::MergeManager(int threads, int online, struct reduce_task *task, in
     }
 }
 
+/*static*/ int MergeManager::get_num_lpq_merge_threads()
+{
+    string value = UdaBridge_invoke_getConfData_callback("mapred.rdma.lpq.merge.threads", "1");
+    return max(1, atoi(value.c_str()));
+}
+
+/*static*/ int MergeManager::get_num_parallel_lpqs(int num_lpq_merge_threads)
+{
+    string value = UdaBridge_invoke_getConfData_callback("mapred.rdma.num.parallel.lpqs", "0");
+    int num_parallel_lpqs = atoi(value.c_str());
+    num_parallel_lpqs = (num_parallel_lpqs < MIN_PARALLEL_LPQS) ? MIN_PARALLEL_LPQS : num_parallel_lpqs;
+    // every merging LPQ holds its quota until spilled - leave quota for fetching the next LPQ
+    return max(num_parallel_lpqs, num_lpq_merge_threads + 1);
+}
+
 int MergeManager::update_fetch_req(client_part_req_t *req)
 {
     /*
@@ -408,8 +653,69 @@ int MergeManager::update_fetch_req(client_part_req_t *req)
     return 1;
 }
 
+// indexes the records of the buffer that was just fetched, before the merge can see it
+static void index_fetched_records(MapOutput *mop)
+{
+	mem_desc_t *desc = mop->mop_bufs[mop->staging_mem_idx];
+	if (!desc->rec_index) {
+		desc->rec_index = new RecordIndex();
+	}
+	desc->rec_index->build(desc->buff, (uint32_t)mop->last_fetched, mop->scan_state);
+}
+
+// folds the buffer that was just fetched into the checksum of the map output.
+// returns false when the map output is complete and its checksum does not match
+// the big endian crc32 that ends the partition
+static bool verify_fetched_data(MapOutput *mop)
+{
+	mem_desc_t *desc = mop->mop_bufs[mop->staging_mem_idx];
+	int64_t data_len = mop->total_len_rdma - IFILE_CHECKSUM_LEN;
+	int64_t end = mop->fetched_len_rdma;
+	int64_t start = end - mop->last_fetched;
+
+	if (data_len < 0) {
+		return true; // no trailer
+	}
+	if (start < data_len) {
+		mop->checksum = crc32_update(mop->checksum, desc->buff, min(end, data_len) - start);
+	}
+	for (int64_t pos = max(start, data_len); pos < end && pos < mop->total_len_rdma; ++pos) {
+		mop->checksum_trailer[pos - data_len] = desc->buff[pos - start];
+	}
+	if (end < mop->total_len_rdma) {
+		return true;
+	}
+
+	const unsigned char *t = (const unsigned char *)mop->checksum_trailer;
+	uint32_t expected = ((uint32_t)t[0] << 24) | ((uint32_t)t[1] << 16) | ((uint32_t)t[2] << 8) | t[3];
+	if (expected == mop->checksum) {
+		return true;
+	}
+	log(lsERROR, "checksum error in map output %s of host %s: expected 0x%08x, got 0x%08x",
+			mop->part_req->info->params[2], mop->part_req->info->params[0], expected, mop->checksum);
+	return false;
+}
+
 void MergeManager::mark_req_as_ready(client_part_req_t *req)
 {
+	if (verify_checksums && !verify_fetched_data(req->mop)) {
+		MapOutput *mop = req->mop;
+		// nothing of the map output was merged yet, when it all came in its first fetch
+		if (mop->fetch_count == 0 && mop->fetched_len_rdma == mop->last_fetched &&
+				mop->checksum_refetches < CHECKSUM_MAX_REFETCHES) {
+			++mop->checksum_refetches;
+			log(lsWARN, "fetching map output %s again (%d)", req->info->params[2], mop->checksum_refetches);
+			mop->fetched_len_rdma = 0;
+			mop->checksum = 0;
+			start_fetch_req(req);
+			return;
+		}
+		throw new UdaException("checksum error in map output");
+	}
+
+	if (index_records) {
+		index_fetched_records(req->mop);
+	}
 
 	pthread_mutex_lock(&req->mop->lock);
     req->mop->mop_bufs[req->mop->staging_mem_idx]->status = MERGE_READY;
@@ -480,6 +786,7 @@ MergeManager::~MergeManager()
 {
     pthread_mutex_destroy(&lock);
     pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lpq_merge_lock);
     
     BULLSEYE_EXCLUDE_BLOCK_START
     if (merge_queue != NULL ) {
@@ -493,7 +800,7 @@ MergeManager::~MergeManager()
         }
         pthread_mutex_unlock(&task->kv_pool.lock);
 
-        merge_queue->core_queue.clear(); //TODO: this should be moved into ~MergeQueue()
+        merge_queue->clear(); //TODO: this should be moved into ~MergeQueue()
         delete merge_queue; 
     }
     delete pendingMerge;
@@ -531,6 +838,11 @@ int aio_lpq_write_completion_handler(void* data, int status) {
 int aio_rpq_read_completion_handler(void* data, int status) {
 	rpq_aio_arg* arg = (rpq_aio_arg*)data;
 
+	if (status) {
+		log(lsERROR, "RPQ AIO read failed: status=%d size=%llu total_fetched=%lld", status, arg->size, arg->kv_output->total_fetched);
+		throw new UdaException("aio event: RPQ read failed");
+	}
+
 	pthread_mutex_lock(&arg->kv_output->lock);
 	arg->kv_output->last_fetched = arg->size;
 	arg->kv_output->total_fetched += arg->size;
@@ -627,7 +939,7 @@ void merge_hybrid_lpq_phase(AIOHandler* aio, SegmentMergeQueue* merge_lpqs[], re
 
 		const string & dir = task->local_dirs[local_dir_index]; //just ref - no copy
 		sprintf(temp_file, "%s/NetMerger.%s.lpq-%d", dir.c_str(), task->reduce_task_id, i);
-		merge_lpqs[i] = new SegmentMergeQueue(num_to_fetch, staging_descs, temp_file);
+		merge_lpqs[i] = createSegmentMergeQueue(num_to_fetch, staging_descs, temp_file);
 		merge_do_fetching_phase(task, merge_lpqs[i], num_to_fetch);
 		log(lsDEBUG, "[%d] === Enter merging LPQ using file: %s", i, merge_lpqs[i]->filename.c_str());
 		merge_lpq_to_aio_file(task, merge_lpqs[i], merge_lpqs[i]->filename.c_str(), aio , total_write, mem_desc_idx);
@@ -688,7 +1000,7 @@ void merge_hybrid_rpq_phase(AIOHandler* aio, SegmentMergeQueue* merge_lpqs[], re
 		rpqSegmentsArr[i]->send_request();
 
 		// delete LPQ after inserting AioSegment to RPQ
-		merge_lpqs[i]->core_queue.clear();
+		merge_lpqs[i]->clear();
 		delete merge_lpqs[i];
 
 	}
@@ -47,6 +47,8 @@ enum MERGE_FLAG    {INIT_FLAG, NEW_MOP, FINAL_MERGE};
 #define MERGE_AIOHANDLER_TIMEOUT_IN_NSEC	(300000000)
 #define MERGE_AIOHANDLER_CTX_MAXEVENTS         (100)
 
+#define CHECKSUM_MAX_REFETCHES (3) // of a map output that failed its checksum
+
 #ifndef PATH_MAX  // normally defined in limits.h
 #define PATH_MAX 4096
 #endif
@@ -131,7 +133,12 @@ public:
     MergeManager(int threads, 
                  int online, 
                  struct reduce_task *task,
-                 int _num_lpqs);
+                 int _num_lpqs,
+                 int _spill_fan_in);
+
+    static int get_num_lpq_merge_threads(); // as configured
+    // LPQs that are held at once: as configured, but enough for merging num_lpq_merge_threads of them
+    static int get_num_parallel_lpqs(int num_lpq_merge_threads);
 
     ~MergeManager();
   
@@ -161,6 +168,11 @@ public:
 
     int                          total_count;
     int                          progress_count;
+    bool                         all_resident;   // every fetched map output fit in its first (indexed) buffer
+    int64_t                      resident_bytes; // of these map outputs
+    int64_t                      resident_records; // of these map outputs, as counted by their RecordIndex
+    int64_t                      sort_resident_max_bytes; // merge_online sorts resident map outputs up to this size
+    int64_t                      sort_resident_max_records; // and up to this many records (see SortedRunSegment)
 public:
     const int                    num_lpqs;
     const int                    num_mofs_in_lpq;
@@ -173,7 +185,25 @@ private:
     void *merge_hybrid ();
     static void *lpq_fetcher_start (void *context) throw (UdaException*);
     void fetch_lpqs();
+    static void *lpq_merger_start (void *context) throw (UdaException*);
+    void merge_lpqs();
+    void merge_spill_passes(std::vector<std::string> &spills, std::vector<SpillKeyIndex*> &indexes);
     int num_parallel_lpqs;
+    int spill_fan_in; // max spill files merged at once (by the RPQ or an intermediate pass)
+    int num_lpq_merge_threads; // LPQs that are merged to their spill files at once
+    int num_rpq_threads; // > 1 for merging the RPQ in parallel key ranges
+    bool compress_spills; // use the shuffle's codec also for the LPQ spill files
+    DecompressorWrapper *spill_codec; // NULL when the spill files are not compressed
+    bool use_spill_aio; // write LPQ spill files with AIO + O_DIRECT
+    AIOHandler *spill_aio; // during the LPQs phase only
+    bool index_records; // fetched buffers are indexed by the fetch thread (see RecordIndex)
+    bool verify_checksums; // fetched map outputs are checked against their IFile checksum
+
+    // LPQs in the order they were merged, and their spill indexes (only for parallel RPQ)
+    std::vector<SegmentMergeQueue*> merged_lpqs;
+    std::vector<SpillKeyIndex*>     spill_indexes;
+    int                             next_lpq_to_merge;
+    pthread_mutex_t                 lpq_merge_lock;
     concurrent_external_quota_queue <SegmentMergeQueue*> *pendingMerge;
 };
 
@@ -0,0 +1,96 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#include <math.h>
+#include <algorithm>
+
+#include "MergePlanner.h"
+#include "IOUtility.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+/*static*/ int MergePlan::pass_factor(int fan_in, int pass, int num_spills)
+{
+	if (pass > 0 || num_spills <= fan_in || fan_in == 1)
+		return fan_in;
+	int mod = (num_spills - 1) % (fan_in - 1);
+	if (mod == 0)
+		return fan_in;
+	return mod + 1;
+}
+
+void MergePlan::log_plan(int num_maps) const
+{
+	log(lsINFO, "merge plan: num_maps=%d -> %d levels: %d LPQs of ~%d segments, spill fan-in=%d, %d intermediate passes",
+			num_maps, num_levels, num_lpqs, lpq_fan_in, spill_fan_in, num_passes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+MergePlan plan_merge(int num_maps, int lpq_size, int64_t shuffle_memory, int64_t rdma_buf_size,
+		int num_parallel_lpqs, int num_dirs, int spills_per_disk)
+{
+	MergePlan plan;
+	if (spills_per_disk <= 0) spills_per_disk = DEFAULT_SPILLS_PER_DISK;
+	plan.spill_fan_in = max(2, spills_per_disk * max(1, num_dirs));
+
+	if (lpq_size > 0) {
+		plan.num_lpqs = num_maps / lpq_size;
+		// if more than one segment left then additional lpq added
+		// if only one segment left then the first will be larger
+		if ((num_maps % lpq_size) > 1)
+			plan.num_lpqs++;
+	}
+	else {
+		plan.num_lpqs = (int) sqrt(num_maps);
+
+		if (plan.num_lpqs > plan.spill_fan_in) {
+			// wider LPQs save a merge level, as long as their RDMA buffers fit in memory
+			int64_t mem_fan_in = (rdma_buf_size > 0 && num_parallel_lpqs > 0) ?
+					shuffle_memory / (rdma_buf_size * 2 * num_parallel_lpqs) : 0;
+			int64_t needed_fan_in = (num_maps + plan.spill_fan_in - 1) / plan.spill_fan_in;
+			int64_t lpq_fan_in = min(needed_fan_in, mem_fan_in);
+			if (lpq_fan_in > plan.num_lpqs) // sqrt(num_maps) is the fan-in of the unwidened LPQs
+				plan.num_lpqs = (int)((num_maps + lpq_fan_in - 1) / lpq_fan_in);
+		}
+	}
+	plan.num_lpqs = max(1, plan.num_lpqs);
+	plan.lpq_fan_in = num_maps / plan.num_lpqs;
+
+	// intermediate passes for merging the spills down to spill_fan_in files
+	plan.num_passes = 0;
+	for (int n = plan.num_lpqs; n > plan.spill_fan_in; ++plan.num_passes) {
+		n -= MergePlan::pass_factor(plan.spill_fan_in, plan.num_passes, n) - 1;
+	}
+	// every level cuts the number of spills by spill_fan_in
+	plan.num_levels = 2;
+	for (int64_t reachable = plan.spill_fan_in; reachable < plan.num_lpqs; reachable *= plan.spill_fan_in)
+		plan.num_levels++;
+
+	return plan;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -0,0 +1,71 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#ifndef MERGE_PLANNER_H
+#define MERGE_PLANNER_H
+
+#include <stdint.h>
+
+#define DEFAULT_SPILLS_PER_DISK	32 // spill files that are merged at once from each local dir
+
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * Shape of the hybrid merge:
+ *   level 1 - LPQs merge RDMA fetched segments into num_lpqs spill files
+ *   level 2..num_levels-1 - intermediate passes merge up to spill_fan_in spill files into one
+ *   last level - RPQ merges at most spill_fan_in spill files into Java
+ *
+ * Every spill file that is read at once costs disk seeks, hence spill_fan_in
+ * is bounded per local dir.  When there are too many LPQs for that, they are
+ * made wider - as far as the shuffle memory allows - before adding levels.
+ */
+struct MergePlan
+{
+	int num_lpqs;
+	int lpq_fan_in;   // segments per (regular) LPQ
+	int spill_fan_in; // max spill files per merge pass
+	int num_levels;   // 2 for the classic LPQ + RPQ merge
+	int num_passes;   // intermediate merge passes
+
+	// factor of the given intermediate pass (0 based) out of num_spills files (as in hadoop's Merger):
+	// the first pass takes just enough files for the later passes to be full
+	static int pass_factor(int fan_in, int pass, int num_spills);
+
+	void log_plan(int num_maps) const;
+};
+
+/**
+ * lpq_size > 0 forces the LPQ fan-in, as configured by the user.
+ * rdma_buf_size is the buffer size that is aimed for; every segment of a
+ * merging LPQ holds 2 such buffers, and up to num_parallel_lpqs LPQs are held at once
+ * (the MergeManager's effective value, see MergeManager::get_num_parallel_lpqs).
+ */
+MergePlan plan_merge(int num_maps, int lpq_size, int64_t shuffle_memory, int64_t rdma_buf_size,
+                     int num_parallel_lpqs, int num_dirs, int spills_per_disk);
+
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -22,6 +22,33 @@
 
 using namespace std;
 
+MERGE_HEAP_TYPE g_merge_heap_type = HEAP_BINARY;
+
+MERGE_HEAP_TYPE get_merge_heap_type(const char* name)
+{
+	if (strcasecmp(name, "heap") == 0 || strcasecmp(name, "binary") == 0)
+		return HEAP_BINARY;
+	if (strcasecmp(name, "losertree") == 0)
+		return HEAP_LOSER_TREE;
+
+	log(lsWARN, "unknown merge heap type '%s' - using binary heap", name);
+	return HEAP_BINARY;
+}
+
+SegmentMergeQueue* createSegmentMergeQueue(int numMaps, mem_desc_t* staging_descs, const char* fname, ResetElemFunc resetElemFunc)
+{
+	switch (g_key_compare_kind) {
+	case KEY_COMPARE_TEXT:
+		return createMergeQueue<BaseSegment*, SegmentLess<TextKeyCompare> >(numMaps, staging_descs, fname, resetElemFunc);
+	case KEY_COMPARE_BYTE:
+		return createMergeQueue<BaseSegment*, SegmentLess<ByteKeyCompare> >(numMaps, staging_descs, fname, resetElemFunc);
+	case KEY_COMPARE_BYTES:
+		return createMergeQueue<BaseSegment*, SegmentLess<BytesKeyCompare> >(numMaps, staging_descs, fname, resetElemFunc);
+	default:
+		return createMergeQueue<BaseSegment*, SegmentLess<GenericKeyCompare> >(numMaps, staging_descs, fname, resetElemFunc);
+	}
+}
+
 #if 0
 int MergeQueue::getPassFactor(int factor, int passNo, int numSegments) 
 {
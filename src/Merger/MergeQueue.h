@@ -26,6 +26,7 @@
 #define NUM_STAGE_MEM (2)
 
 
+#include <assert.h>
 #include <vector>
 #include <list>
 #include <string>
@@ -34,8 +35,10 @@
 #include <NetlevComm.h>
 
 #include "IOUtility.h"
+#include "KeySketch.h"
 
 class RawKeyValueIterator;
+class RecordIndex;
 
 enum MEM_STATUS    {INIT, FETCH_READY, MERGE_READY, BUSY};
 
@@ -51,6 +54,7 @@ typedef struct mem_desc {
     	init();
     	this->buff  = addr;
     	this->buf_len = buf_len;
+    	this->rec_index = NULL;
     	pthread_mutex_init(&this->lock, NULL);
     	pthread_cond_init(&this->cond, NULL);
     }
@@ -108,6 +112,8 @@ typedef struct mem_desc {
     uint32_t 			start; //index of the oldest element
     uint32_t				end; //index at which to write new element
 
+    RecordIndex         *rec_index; // records of the fetched data (NULL when not indexed)
+
 } mem_desc_t;
 
 
@@ -120,25 +126,38 @@ typedef struct mem_set_desc {
 
 typedef void (*ResetElemFunc)(void*);
 
+enum MERGE_HEAP_TYPE {HEAP_BINARY, HEAP_LOSER_TREE};
+extern MERGE_HEAP_TYPE g_merge_heap_type; // selected once per reducer (see handle_init_msg)
+MERGE_HEAP_TYPE get_merge_heap_type(const char* name);
+
+
+/* the default order of the merge structures: the elements' operator< */
+template <class T>
+struct DerefLess
+{
+    inline bool operator()(T a, T b) const { return *a < *b; }
+};
+
 
 /****************************************************************************
  * A PriorityQueue maintains a partial ordering of its elements such that the
  * least element can always be found in constant time.  Put()'s and pop()'s
  * require log(size) time. 
  ****************************************************************************/
-template <class T>
+template <class T, class Less = DerefLess<T> >
 class PriorityQueue
 {
 public:
 
 private:
+    Less           m_less;
     std::vector<T> m_heap;
     int            m_size;
     int            m_maxSize;
     ResetElemFunc  m_resetElemFunc;
 public:
 
-    PriorityQueue<T>(int maxSize, ResetElemFunc  resetElemFunc) {
+    PriorityQueue(int maxSize, ResetElemFunc  resetElemFunc) {
     	m_resetElemFunc = resetElemFunc;
         m_size = 0;
         int heapSize = maxSize + 1;
@@ -148,9 +167,7 @@ public:
             m_heap[i] = NULL;
         }
     }
-    
-    virtual ~PriorityQueue() {}
-  
+
     /**
      * Right now, there is no extra exception handling in thi part
      * Please avoid putting too mand objects into the priority queue
@@ -242,7 +259,7 @@ private:
         int i = m_size;
         T node = m_heap[i];			  /* save bottom node*/
         int j = i >> 1;
-        while (j > 0 && (*node < *(m_heap[j]))) {
+        while (j > 0 && m_less(node, m_heap[j])) {
             m_heap[i] = m_heap[j];	  /* shift parents down*/
             i = j;
             j = j >> 1;				 
@@ -255,16 +272,16 @@ private:
         T node = m_heap[i];			  /* save top node*/
         int j = i << 1;				  /* find smaller child*/
         int k = j + 1;
-        if (k <= m_size && (*(m_heap[k]) < *(m_heap[j]))) {
+        if (k <= m_size && m_less(m_heap[k], m_heap[j])) {
             j = k;
         }
 
-        while (j <= m_size && (*(m_heap[j]) < *node)) {
+        while (j <= m_size && m_less(m_heap[j], node)) {
             m_heap[i] = m_heap[j];	  /* shift up child*/
             i = j;
             j = i << 1;
             k = j + 1;
-            if (k <= m_size && (*(m_heap[k]) < *m_heap[j])) {
+            if (k <= m_size && m_less(m_heap[k], m_heap[j])) {
                 j = k;
             }
         }
@@ -273,12 +290,157 @@ private:
 };
 
 /****************************************************************************
- * The implementation of PriorityQueue and RawKeyValueIterator
+ * A LoserTree (tournament tree) keeps the loser of every match in the inner
+ * nodes, so after the top element changes value it only replays the matches
+ * on the path from its leaf to the root: exactly one comparison per level
+ * (log(size)) and no sibling compares, vs. up to 2*log(size) in downHeap().
+ * The tree is built lazily on the first top() after put()'s; pop()'ed leaves
+ * stay in place as exhausted entries that lose every match, until a put()
+ * needs their slots (or the tree drains) and the leaves are packed again.
  ****************************************************************************/
-template <class T>
-class MergeQueue 
+template <class T, class Less = DerefLess<T> >
+class LoserTree
 {
 private:
+    Less             m_less;
+    std::vector<T>   m_leaves; /* NULL leaf = exhausted */
+    std::vector<int> m_tree;   /* [0] is the winner leaf, [1..k-1] are losers */
+    int              m_numLeaves;
+    int              m_size;
+    bool             m_dirty;  /* put() was called since last build */
+    ResetElemFunc    m_resetElemFunc;
+
+public:
+    LoserTree(int maxSize, ResetElemFunc resetElemFunc) {
+        m_resetElemFunc = resetElemFunc;
+        m_numLeaves = 0;
+        m_size = 0;
+        m_dirty = false;
+        m_leaves.resize(maxSize, NULL);
+        m_tree.resize(maxSize > 0 ? maxSize : 1, 0);
+    }
+
+    /* same contract as PriorityQueue::put - do not exceed maxSize */
+    void put(T element) {
+        if (m_numLeaves == (int)m_leaves.size())
+            compact();
+        assert(m_numLeaves < (int)m_leaves.size());
+        m_leaves[m_numLeaves++] = element;
+        m_size++;
+        m_dirty = true;
+    }
+
+    T top() {
+        if (m_size == 0)
+            return NULL;
+        if (m_dirty)
+            build();
+        return m_leaves[m_tree[0]];
+    }
+
+    /* removes the least element and replays its path with an empty leaf */
+    T pop() {
+        T result = top();
+        if (result != NULL) {
+            int leaf = m_tree[0];
+            m_leaves[leaf] = NULL;
+            m_size--;
+            if (m_size == 0)
+                m_numLeaves = 0; // all the leaves are exhausted: start over
+            else
+                replay(leaf);
+        }
+        return result;
+    }
+
+    /* Be called when the object at top changes values.*/
+    void adjustTop() {
+        if (m_dirty)
+            build();
+        else if (m_size > 0)
+            replay(m_tree[0]);
+    }
+
+    int size() {
+        return m_size;
+    }
+
+    void clear() {
+        for (int i = 0; i < m_numLeaves; i++) {
+            if (m_leaves[i] != NULL) {
+                m_resetElemFunc(m_leaves[i]);
+                m_leaves[i] = NULL;
+            }
+        }
+        m_numLeaves = 0;
+        m_size = 0;
+        m_dirty = false;
+    }
+
+private:
+
+    /* exhausted leaves lose against everything */
+    inline bool less(int a, int b) {
+        if (m_leaves[b] == NULL) return m_leaves[a] != NULL;
+        if (m_leaves[a] == NULL) return false;
+        return m_less(m_leaves[a], m_leaves[b]);
+    }
+
+    /* drops the exhausted leaves; the tree is rebuilt on the next top() */
+    void compact() {
+        int n = 0;
+        for (int i = 0; i < m_numLeaves; i++) {
+            if (m_leaves[i] != NULL)
+                m_leaves[n++] = m_leaves[i];
+        }
+        for (int i = n; i < m_numLeaves; i++)
+            m_leaves[i] = NULL;
+        m_numLeaves = n;
+        m_dirty = true;
+    }
+
+    /* leaf i sits at node (i + k) of an implicit tree whose root is node 1 */
+    void replay(int leaf) {
+        int winner = leaf;
+        for (int node = (leaf + m_numLeaves) >> 1; node > 0; node >>= 1) {
+            if (less(m_tree[node], winner)) {
+                int loser = winner;
+                winner = m_tree[node];
+                m_tree[node] = loser;
+            }
+        }
+        m_tree[0] = winner;
+    }
+
+    void build() {
+        int k = m_numLeaves;
+        std::vector<int> winners(2 * k);
+        for (int i = 0; i < k; i++)
+            winners[k + i] = i;
+        for (int node = k - 1; node > 0; node--) {
+            int a = winners[2 * node];
+            int b = winners[2 * node + 1];
+            if (less(b, a)) {
+                winners[node] = b;
+                m_tree[node] = a;
+            } else {
+                winners[node] = a;
+                m_tree[node] = b;
+            }
+        }
+        m_tree[0] = (k > 1) ? winners[1] : 0;
+        m_dirty = false;
+    }
+};
+
+/****************************************************************************
+ * The implementation of PriorityQueue and RawKeyValueIterator: what the
+ * users of a MergeQueue see, whatever structure it keeps its segments in
+ ****************************************************************************/
+template <class T>
+class BaseMergeQueue
+{
+protected:
     std::list<T> *mSegments;
 //    T min_segment;
     DataStream *key;
@@ -287,18 +449,100 @@ private:
 public:
     const std::string filename;
     mem_desc_t*  staging_bufs[NUM_STAGE_MEM];
-    PriorityQueue<T> core_queue;
     T min_segment;
 public: 
 	// #if LCOV_HYBRID_MERGE_DEAD_CODE
     	size_t getQueueSize() { return num_of_segments; }
 	// #endif
 
-    virtual ~MergeQueue(){}
+    virtual ~BaseMergeQueue(){}
     int        mergeq_flag;  /* flag to check the former k,v */
+    HotKeySketch *key_sketch; // counts the merged keys; NULL unless hot keys are tracked
     RawKeyValueIterator* merge(int factor, int inMem, std::string &tmpDir);
     DataStream* getKey() { return this->key; }
     DataStream* getVal() { return this->val; }
+
+    /* moves to the next record: the one virtual call of a merged record */
+    virtual bool next() = 0;
+    virtual bool insert(T segment) = 0;
+
+    /* the segments in the merge structure */
+    virtual int  size() = 0;
+    virtual T    pop() = 0;
+    virtual void clear() = 0;
+
+    int32_t get_key_len() {return this->min_segment->cur_key_len;}
+    int32_t get_val_len() {return this->min_segment->cur_val_len;}
+    int32_t get_key_bytes(){return this->min_segment->kbytes;}
+    int32_t get_val_bytes() {return this->min_segment->vbytes;}
+
+      BaseMergeQueue(mem_desc_t* staging_descs, const char*fname)
+      	  	  	  : filename(fname)
+{
+    	this->num_of_segments=0;
+        this->mSegments = NULL;
+        this->min_segment = NULL;
+        this->key = NULL;
+        this->val = NULL;
+        this->mergeq_flag = 0;
+        this->key_sketch = NULL;
+         
+        if (staging_descs) {
+        	for (int i=0;i < NUM_STAGE_MEM; i++)  
+		        this->staging_bufs[i] = &staging_descs[i];
+        }
+		else{
+        	for (int i=0;i < NUM_STAGE_MEM; i++)  
+		        this->staging_bufs[i] = NULL;
+		}
+    }
+
+#if _BullseyeCoverage
+	#pragma BullseyeCoverage off
+#endif
+		BaseMergeQueue(std::list<T> *segments){
+			this->mSegments = segments;
+			this->min_segment = NULL;
+			this->key_sketch = NULL;
+		}
+
+#if _BullseyeCoverage
+	#pragma BullseyeCoverage on
+#endif
+
+protected:
+    /* the record of the least segment is the current one */
+    void set_min_segment(T segment) {
+        this->min_segment = segment;
+        this->key = &this->min_segment->key;
+        this->val = &this->min_segment->val;
+
+        if (key_sketch) {
+            key_sketch->add(key->getData(), min_segment->cur_key_len, min_segment->kbytes + min_segment->vbytes +
+                            min_segment->cur_key_len + min_segment->cur_val_len);
+        }
+    }
+
+    bool lessThan(T a, T b);
+    int  getPassFactor(int factor, int passNo, int numSegments);
+    void getSegmentDescriptors(std::list<T> &inputs,
+                               std::list<T> &outputs,
+                               int numDescriptors);
+};
+
+/****************************************************************************
+ * A MergeQueue keeps its segments in a Heap (PriorityQueue or LoserTree, with
+ * their order), so merging a record makes no virtual calls but next()
+ ****************************************************************************/
+template <class T, class Heap = PriorityQueue<T> >
+class MergeQueue : public BaseMergeQueue<T>
+{
+public:
+    Heap core_queue;
+
+    MergeQueue(int numMaps, mem_desc_t* staging_descs = NULL ,const char*fname = "", ResetElemFunc  resetElemFunc = NULL)
+        : BaseMergeQueue<T>(staging_descs, fname), core_queue(numMaps, resetElemFunc) {}
+
     bool next() {
         if(this->mergeq_flag) {
             return true;
@@ -316,10 +560,7 @@ public:
                 return false;
             }
         }
-        this->min_segment = core_queue.top();
-        this->key = &this->min_segment->key;
-        this->val = &this->min_segment->val;
-
+        this->set_min_segment(core_queue.top());
         return true;
     }
 
@@ -332,7 +573,7 @@ public:
             }
             case 1: { /*next keyVal exist*/
                 core_queue.put(segment);
-                num_of_segments++;
+                this->num_of_segments++;
                 break;
             }
             case -1: { /*break in the middle of the data*/
@@ -349,47 +590,12 @@ public:
         return true;
     }
 
-    int32_t get_key_len() {return this->min_segment->cur_key_len;}
-    int32_t get_val_len() {return this->min_segment->cur_val_len;}
-    int32_t get_key_bytes(){return this->min_segment->kbytes;}
-    int32_t get_val_bytes() {return this->min_segment->vbytes;}
-
-      MergeQueue(int numMaps, mem_desc_t* staging_descs = NULL ,const char*fname = "", ResetElemFunc  resetElemFunc = NULL)
-      	  	  	  : filename(fname), core_queue(numMaps, resetElemFunc)
-{
-    	this->num_of_segments=0;
-        this->mSegments = NULL;
-        this->min_segment = NULL;
-        this->key = NULL;
-        this->val = NULL;
-        this->mergeq_flag = 0;
-         
-        if (staging_descs) {
-        	for (int i=0;i < NUM_STAGE_MEM; i++)  
-		        this->staging_bufs[i] = &staging_descs[i];
-        }
-		else{
-        	for (int i=0;i < NUM_STAGE_MEM; i++)  
-		        this->staging_bufs[i] = NULL;
-		}
-    }
-
-#if _BullseyeCoverage
-	#pragma BullseyeCoverage off
-#endif
-		MergeQueue(std::list<T> *segments){
-			this->mSegments = segments;
-			this->min_segment = NULL;
-		}
-
-#if _BullseyeCoverage
-	#pragma BullseyeCoverage on
-#endif
-
+    int  size()  { return core_queue.size(); }
+    T    pop()   { return core_queue.pop(); }
+    void clear() { core_queue.clear(); }
 
 protected:
 
-    bool lessThan(T a, T b);
     void adjustPriorityQueue(T segment) {
     	int ret = segment->nextKV();
 
@@ -397,7 +603,7 @@ protected:
     	case 0: { /*no more data for this segment*/
     		T s = core_queue.pop();
     		delete s;
-    		num_of_segments--;
+    		this->num_of_segments--;
     		break;
     	}
     	case 1: { /*next KV pair exist*/
@@ -412,7 +618,7 @@ protected:
     				core_queue.adjustTop();
     			} else {
     				T s = core_queue.pop();
-    				num_of_segments--;
+    				this->num_of_segments--;
     				delete s;
     			}
     		}
@@ -420,14 +626,17 @@ protected:
     	}
     	}
     }
+};
 
+/* a MergeQueue in the merge structure that was selected for this reducer, ordered by Less */
+template <class T, class Less>
+BaseMergeQueue<T>* createMergeQueue(int numMaps, mem_desc_t* staging_descs, const char*fname, ResetElemFunc resetElemFunc)
+{
+    if (g_merge_heap_type == HEAP_LOSER_TREE)
+        return new MergeQueue<T, LoserTree<T, Less> >(numMaps, staging_descs, fname, resetElemFunc);
+    return new MergeQueue<T, PriorityQueue<T, Less> >(numMaps, staging_descs, fname, resetElemFunc);
+}
 
-    int  getPassFactor(int factor, int passNo, int numSegments);
-    void getSegmentDescriptors(std::list<T> &inputs,
-                               std::list<T> &outputs,
-                               int numDescriptors);
-
-};
 
 #endif
 
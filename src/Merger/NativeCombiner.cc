@@ -0,0 +1,100 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#include <string.h>
+#include <endian.h>
+
+#include "NativeCombiner.h"
+#include "IOUtility.h"
+
+const native_combiner_t *g_combiner = NULL;
+
+// Writables are serialized big endian; sums wrap around as in Java
+static inline int32_t load_int(const char *p) {uint32_t v; memcpy(&v, p, 4); return (int32_t)be32toh(v);}
+static inline int64_t load_long(const char *p) {uint64_t v; memcpy(&v, p, 8); return (int64_t)be64toh(v);}
+static inline void store_int(char *p, int32_t x) {uint32_t v = htobe32((uint32_t)x); memcpy(p, &v, 4);}
+static inline void store_long(char *p, int64_t x) {uint64_t v = htobe64((uint64_t)x); memcpy(p, &v, 8);}
+
+static void int_sum(char *acc, const char *val) {store_int(acc, (int32_t)((uint32_t)load_int(acc) + (uint32_t)load_int(val)));}
+static void int_min(char *acc, const char *val) {if (load_int(val) < load_int(acc)) memcpy(acc, val, 4);}
+static void int_max(char *acc, const char *val) {if (load_int(val) > load_int(acc)) memcpy(acc, val, 4);}
+static void long_sum(char *acc, const char *val) {store_long(acc, (int64_t)((uint64_t)load_long(acc) + (uint64_t)load_long(val)));}
+static void long_min(char *acc, const char *val) {if (load_long(val) < load_long(acc)) memcpy(acc, val, 8);}
+static void long_max(char *acc, const char *val) {if (load_long(val) > load_long(acc)) memcpy(acc, val, 8);}
+
+static const native_combiner_t NATIVE_COMBINERS[] = {
+	{"IntSum",  4, int_sum},
+	{"IntMin",  4, int_min},
+	{"IntMax",  4, int_max},
+	{"LongSum", 8, long_sum},
+	{"LongMin", 8, long_min},
+	{"LongMax", 8, long_max},
+};
+
+// hadoop's reducers that may serve as combiners, and their native equivalents
+static const char *JAVA_COMBINERS[][2] = {
+	{"org.apache.hadoop.mapred.lib.LongSumReducer",          "LongSum"},
+	{"org.apache.hadoop.mapreduce.lib.reduce.LongSumReducer", "LongSum"},
+	{"org.apache.hadoop.mapreduce.lib.reduce.IntSumReducer",  "IntSum"},
+};
+
+static const native_combiner_t *find_combiner(const char *name) {
+	for (size_t i = 0; i < sizeof(NATIVE_COMBINERS) / sizeof(NATIVE_COMBINERS[0]); ++i) {
+		if (strcmp(name, NATIVE_COMBINERS[i].name) == 0)
+			return &NATIVE_COMBINERS[i];
+	}
+	return NULL;
+}
+
+const native_combiner_t *get_native_combiner(const char *combiner_name, const char *java_combiner_class) {
+
+	if (combiner_name && strcmp(combiner_name, "none") == 0) {
+		return NULL;
+	}
+
+	if (combiner_name && *combiner_name) {
+		const native_combiner_t *combiner = find_combiner(combiner_name);
+		if (!combiner) {
+			log(lsERROR, "unsupported native combiner: '%s'", combiner_name);
+			throw new UdaException("unsupported native combiner");
+		}
+		log(lsINFO, "using native combiner: %s", combiner->name);
+		return combiner;
+	}
+
+	if (java_combiner_class && *java_combiner_class) {
+		for (size_t i = 0; i < sizeof(JAVA_COMBINERS) / sizeof(JAVA_COMBINERS[0]); ++i) {
+			if (strcmp(java_combiner_class, JAVA_COMBINERS[i][0]) == 0) {
+				log(lsINFO, "using native combiner %s for the job's combiner %s", JAVA_COMBINERS[i][1], java_combiner_class);
+				return find_combiner(JAVA_COMBINERS[i][1]);
+			}
+		}
+		log(lsDEBUG, "no native combiner for the job's combiner %s", java_combiner_class);
+	}
+	return NULL;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
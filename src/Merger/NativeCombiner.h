@@ -0,0 +1,49 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#ifndef __NATIVE_COMBINER
+#define __NATIVE_COMBINER
+
+#include <stdint.h>
+
+// in-merge aggregation of the values of consecutive equal keys - like a combiner that
+// runs inside the merge - for values of a fixed serialized size (Int/LongWritable)
+typedef struct native_combiner {
+	const char  *name;
+	int32_t      val_len; // serialized size of every value
+	void       (*combine)(char *acc, const char *val); // acc = acc (op) val, both serialized
+} native_combiner_t;
+
+// set once on init_reduce_task; NULL when records are not combined
+extern const native_combiner_t *g_combiner;
+
+// combiner_name is one of: IntSum, IntMin, IntMax, LongSum, LongMin, LongMax, or "none";
+// when empty, the job's combiner class is used if it is one of hadoop's Int/LongSumReducer
+const native_combiner_t *get_native_combiner(const char *combiner_name, const char *java_combiner_class);
+
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
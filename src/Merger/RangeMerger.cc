@@ -0,0 +1,239 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#include <algorithm>
+#include <map>
+
+#include "RangeMerger.h"
+#include "reducer.h"
+#include "UdaBridge.h"
+#include "CompareFunc.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+struct SampledKeyLess {
+	bool operator()(const string *a, const string *b) const {
+		return g_cmp_func((char*)a->data(), a->length(), (char*)b->data(), b->length()) < 0;
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+RangeMerger::RangeMerger(struct reduce_task *_task, int _num_threads, DecompressorWrapper *_spill_codec) :
+	task(_task), num_threads(_num_threads), spill_codec(_spill_codec), buf_len(0)
+{
+}
+
+RangeMerger::~RangeMerger()
+{
+	for (size_t i = 0; i < ranges.size(); ++i) {
+		delete ranges[i]->queue;
+		delete ranges[i]->sketch;
+		delete ranges[i];
+	}
+
+	// the ranges' SuperSegments leave the files in place
+	for (size_t i = 0; i < spill_paths.size(); ++i) {
+		remove(spill_paths[i].c_str());
+	}
+}
+
+void RangeMerger::add_spill(const std::string &path, SpillKeyIndex *index)
+{
+	spill_paths.push_back(path);
+	spill_indexes.push_back(index);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// every sampled key stands for about the same amount of spilled bytes,
+// hence quantiles of all samples split the data into similar ranges
+void RangeMerger::choose_splitters(int num_ranges)
+{
+	vector<const string*> samples;
+	for (size_t i = 0; i < spill_indexes.size(); ++i) {
+		for (size_t j = 0; j < spill_indexes[i]->keys.size(); ++j) {
+			samples.push_back(&spill_indexes[i]->keys[j]);
+		}
+	}
+	sort(samples.begin(), samples.end(), SampledKeyLess());
+
+	splitters.clear();
+	for (int r = 1; r < num_ranges && !samples.empty(); ++r) {
+		const string *key = samples[(size_t)r * samples.size() / num_ranges];
+		// skip duplicates - an empty range has nothing to merge
+		if (splitters.empty() || SampledKeyLess()(&splitters.back(), key)) {
+			splitters.push_back(*key);
+		}
+	}
+	log(lsDEBUG, "chose %d splitters out of %d sampled keys", (int)splitters.size(), (int)samples.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/*static*/ void *RangeMerger::merge_range_start(void *context) throw (UdaException*)
+{
+	KeyRange *range = (KeyRange*)context;
+	try {
+		range->owner->merge_range(range);
+	}
+	catch (UdaException *ex) {
+		log(lsERROR, "[R %d] merge of key range failed", range->id);
+		range->error = ex;
+		range->full_bufs.push(NULL); // merge() is waiting for the end of the range
+	}
+	return NULL;
+}
+
+void RangeMerger::merge_range(KeyRange *range)
+{
+	log(lsDEBUG, "[R %d] started", range->id);
+	range->queue = createSegmentMergeQueue(spill_paths.size());
+	range->queue->key_sketch = range->sketch;
+	for (size_t i = 0; i < spill_paths.size(); ++i) {
+		int64_t offset = range->lower_key ? spill_indexes[i]->seek_offset(*range->lower_key) : 0;
+		range->queue->insert(new SuperSegment(task, spill_paths[i], offset, range->lower_key, range->upper_key, spill_codec));
+	}
+
+	// only the last range terminates the stream with EOF marker
+	bool write_eof = (range->upper_key == NULL);
+	bool done = false;
+	while (!done && !task->merge_thread.stop) {
+		mem_desc_t *desc;
+		range->free_bufs.wait_and_pop(desc);
+		if (!desc) { // another range failed
+			break;
+		}
+		done = write_kv_to_mem(range->queue, desc->buff, buf_len, desc->act_len, write_eof);
+
+		if (desc->act_len > 0) {
+			range->full_bufs.push(desc);
+		}
+		else { // Java treats an empty buffer as end of data
+			range->free_bufs.push(desc);
+			if (!done) {
+				log(lsERROR, "[R %d] record is larger than staging buffer of %d bytes", range->id, buf_len);
+				throw new UdaException("record is larger than staging buffer");
+			}
+		}
+	}
+	range->full_bufs.push(NULL);
+	log(lsDEBUG, "[R %d] finished", range->id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RangeMerger::merge()
+{
+	// all LPQs were spilled - RDMA buffers are free for staging (desc_arr holds pairs)
+	memory_pool_t *pool = &task->getMergingSm()->mop_pool;
+	int num_bufs = pool->num * NUM_STAGE_MEM;
+	buf_len = 1 << NETLEV_KV_POOL_EXPO; // Java's kv_buf size
+	for (int i = 0; i < num_bufs; ++i) {
+		bufs.push_back(&pool->desc_arr[i]);
+		buf_len = min(buf_len, (int32_t)pool->desc_arr[i].buf_len);
+	}
+
+	choose_splitters(min(num_threads, num_bufs / MIN_BUFS_PER_RANGE));
+	int num_ranges = splitters.size() + 1;
+	log(lsINFO, "RPQ: merging %d spills in %d key ranges using %d staging buffers of %d bytes",
+			(int)spill_paths.size(), num_ranges, num_bufs, buf_len);
+
+	for (int r = 0; r < num_ranges; ++r) {
+		KeyRange *range = new KeyRange();
+		range->owner = this;
+		range->id = r;
+		range->lower_key = (r > 0) ? &splitters[r - 1] : NULL;
+		range->upper_key = (r < num_ranges - 1) ? &splitters[r] : NULL;
+		range->sketch = HotKeySketch::create();
+		ranges.push_back(range);
+	}
+	for (int i = 0; i < num_bufs; ++i) {
+		ranges[i % num_ranges]->free_bufs.push(bufs[i]);
+		ranges[i % num_ranges]->num_bufs++;
+	}
+	for (int r = 0; r < num_ranges; ++r) {
+		uda_thread_create(&ranges[r]->thread, NULL, merge_range_start, ranges[r]);
+	}
+
+	JNIEnv *mergerJniEnv = UdaBridge_threadGetEnv();
+	map<mem_desc_t*, jobject> jbufs; // register each buffer once with Java
+
+	UdaException *error = NULL;
+	for (int r = 0; r < num_ranges && !error; ++r) {
+		KeyRange *range = ranges[r];
+		mem_desc_t *desc;
+		for (range->full_bufs.wait_and_pop(desc); desc; range->full_bufs.wait_and_pop(desc)) {
+			jobject &jbuf = jbufs[desc];
+			if (!jbuf) {
+				jbuf = UdaBridge_registerDirectByteBuffer(mergerJniEnv, desc->buff, buf_len);
+			}
+			log(lsTRACE, "[R %d] invoking java callback: desc=%p, jbuf=%p, act_len=%d", r, desc, jbuf, desc->act_len);
+			UdaBridge_invoke_dataFromUda_callback(mergerJniEnv, jbuf, desc->act_len);
+			range->free_bufs.push(desc);
+		}
+		pthread_join(range->thread, NULL);
+		if (range->error) {
+			error = range->error;
+			stop_ranges(r + 1);
+			break;
+		}
+		if (range->sketch && r > 0) {
+			ranges[0]->sketch->merge(*range->sketch);
+		}
+
+		// range is over - its buffers let the next ranges run further ahead
+		if (r + 1 < num_ranges) {
+			for (int i = 0; i < range->num_bufs; ++i) {
+				range->free_bufs.wait_and_pop(desc);
+				ranges[r + 1]->free_bufs.push(desc);
+			}
+			ranges[r + 1]->num_bufs += range->num_bufs;
+			range->num_bufs = 0;
+		}
+	}
+
+	for (map<mem_desc_t*, jobject>::iterator it = jbufs.begin(); it != jbufs.end(); ++it) {
+		mergerJniEnv->DeleteWeakGlobalRef((jweak)it->second);
+	}
+	if (error) {
+		throw error;
+	}
+	log(lsINFO, "RPQ: all %d key ranges were merged", num_ranges);
+	if (ranges[0]->sketch) {
+		ranges[0]->sketch->report(task->reduce_task_id);
+	}
+}
+
+// the workers of the ranges from 'first' on stop at their next free buffer
+void RangeMerger::stop_ranges(int first)
+{
+	for (size_t r = first; r < ranges.size(); ++r) {
+		ranges[r]->free_bufs.push(NULL);
+	}
+	for (size_t r = first; r < ranges.size(); ++r) {
+		pthread_join(ranges[r]->thread, NULL);
+	}
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
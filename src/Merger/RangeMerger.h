@@ -0,0 +1,102 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#ifndef RANGE_MERGER_H
+#define RANGE_MERGER_H
+
+#include <string>
+#include <vector>
+
+#include "MergeManager.h"
+
+struct reduce_task;
+
+#define RPQ_KEY_INDEX_INTERVAL	(1<<20) // bytes of spill file per sampled key
+#define MIN_BUFS_PER_RANGE		(2)     // double buffering per key range
+
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * Parallel final merge (RPQ) of LPQ spill files by key-range partitioning.
+ *
+ * Splitter keys are picked from the sparse key indexes of the spill files,
+ * so each of the N key ranges holds a similar share of the data.  Every range
+ * is merged by its own worker thread - out of SuperSegments that seek to the
+ * range start - into its own staging buffers.  The merge thread hands the
+ * buffers to Java range after range, which keeps the output sorted.
+ *
+ * The staging buffers are borrowed from the RDMA buffer pool, which is idle
+ * once all LPQs were spilled.
+ */
+class RangeMerger
+{
+public:
+	// spill_codec != NULL when the spill files are block compressed
+	RangeMerger(struct reduce_task *task, int num_threads, DecompressorWrapper *spill_codec = NULL);
+	~RangeMerger();
+
+	// index is owned by the caller and must live until merge() returns
+	void add_spill(const std::string &path, SpillKeyIndex *index);
+
+	// merges all spills into Java; returns after the last buffer was handed over.
+	// rethrows the exception of a range that failed, once all workers are done
+	void merge();
+
+private:
+	struct KeyRange {
+		KeyRange() : lower_key(NULL), upper_key(NULL), queue(NULL), sketch(NULL), num_bufs(0), thread(0), error(NULL) {}
+
+		const std::string                *lower_key; // NULL for the first range
+		const std::string                *upper_key; // NULL for the last range
+		SegmentMergeQueue                *queue;
+		HotKeySketch                     *sketch; // hot keys of the range; NULL unless tracked
+		concurrent_queue<mem_desc_t*>     free_bufs; // NULL stops the worker
+		concurrent_queue<mem_desc_t*>     full_bufs; // NULL marks end of range
+		int                               num_bufs;
+		pthread_t                         thread;
+		UdaException                     *error; // that ended the worker, rethrown by merge()
+		RangeMerger                      *owner;
+		int                               id;
+	};
+
+	void choose_splitters(int num_ranges);
+	void merge_range(KeyRange *range);
+	void stop_ranges(int first); // of a merge that failed
+	static void *merge_range_start(void *context) throw (UdaException*);
+
+	struct reduce_task         *task;
+	const int                   num_threads;
+	DecompressorWrapper        *spill_codec;
+	std::vector<std::string>    spill_paths;
+	std::vector<SpillKeyIndex*> spill_indexes;
+	std::vector<std::string>    splitters;
+	std::vector<KeyRange*>      ranges;
+	std::vector<mem_desc_t*>    bufs;
+	int32_t                     buf_len; // usable bytes of each staging buffer
+};
+
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
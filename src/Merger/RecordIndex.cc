@@ -0,0 +1,104 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#include <string.h>
+#include <algorithm>
+
+#include "RecordIndex.h"
+#include "CompareFunc.h"
+#include "IOUtility.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+void RecordIndex::build(const char *buf, uint32_t len, record_scan_state_t &state)
+{
+	clear();
+	if (!state.valid) return;
+
+	int32_t key_len, val_len, kbytes, vbytes;
+	uint32_t pos = 0;
+
+	// a record header that was split: the record continues in this buffer
+	if (state.header_len > 0) {
+		char header[2 * RECORD_HEADER_MAX_SIZE];
+		uint32_t more = min(len, (uint32_t)RECORD_HEADER_MAX_SIZE);
+		memcpy(header, state.header, state.header_len);
+		memcpy(header + state.header_len, buf, more);
+		int size = StreamUtility::decodeKVHeader(header, state.header_len + more, key_len, val_len, kbytes, vbytes);
+		if (!size && more == len) { // a tiny buffer: the header continues further
+			memcpy(state.header + state.header_len, buf, len);
+			state.header_len += len;
+			return;
+		}
+		if (!size || key_len < 0 || val_len < 0) {
+			state.valid = false; // also the EOF marker
+			return;
+		}
+		state.skip = (int64_t)size - state.header_len + key_len + val_len;
+		state.header_len = 0;
+	}
+
+	if (state.skip > 0) {
+		if (state.skip >= len) {
+			state.skip -= len;
+			return;
+		}
+		pos = (uint32_t)state.skip;
+		state.skip = 0;
+	}
+
+	while (pos < len) {
+		int size = StreamUtility::decodeKVHeader(buf + pos, len - pos, key_len, val_len, kbytes, vbytes);
+		if (!size) { // the header continues in the next buffer
+			state.header_len = len - pos;
+			memcpy(state.header, buf + pos, state.header_len);
+			return;
+		}
+		if (key_len < 0 || val_len < 0) {
+			state.valid = false; // EOF marker (or a corrupted record) - left for the merge
+			return;
+		}
+
+		int64_t total = (int64_t)size + key_len + val_len;
+		if (pos + total > len) { // the record continues in the next buffer
+			state.skip = pos + total - len;
+			return;
+		}
+
+		record_entry_t entry;
+		entry.offset = pos;
+		entry.key_len = key_len;
+		entry.val_len = val_len;
+		entry.kbytes = (uint8_t)kbytes;
+		entry.vbytes = (uint8_t)vbytes;
+		entry.prefix = g_prefix_func((char*)buf + pos + size, key_len);
+		entries.push_back(entry);
+		pos += (uint32_t)total;
+	}
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -0,0 +1,87 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#ifndef __RECORD_INDEX
+#define __RECORD_INDEX
+
+#include <stdint.h>
+#include <vector>
+
+#define RECORD_HEADER_MAX_SIZE 18 // two VLongs
+
+// a record of a fetched buffer, decoded ahead of the merge
+typedef struct record_entry {
+	uint32_t offset;   // of the record header in the buffer
+	int32_t  key_len;
+	int32_t  val_len;
+	uint8_t  kbytes;   // sizes of the VInt lengths
+	uint8_t  vbytes;
+	uint64_t prefix;   // g_prefix_func of the key
+} record_entry_t;
+
+// where the records of the next buffer of a map output start; kept by the map output
+// between its buffers (a record may straddle them)
+typedef struct record_scan_state {
+	bool     valid;      // false after a buffer that could not be scanned: no more indexing
+	int64_t  skip;       // bytes at the start of the next buffer that belong to an earlier record
+	int32_t  header_len; // bytes of a record header that was split between the buffers
+	char     header[RECORD_HEADER_MAX_SIZE];
+
+	void init() { valid = true; skip = 0; header_len = 0; }
+} record_scan_state_t;
+
+/*
+ * The records of a fetched (uncompressed) buffer of a map output, built by the fetch
+ * thread when the buffer becomes MERGE_READY, so the merge thread only advances in
+ * this index instead of decoding the records one at a time (see BaseSegment::nextKVInternal)
+ */
+class RecordIndex
+{
+public:
+	RecordIndex() : cursor(0) {}
+
+	// indexes the whole records of buf[0, len), continuing the scan of the previous buffer
+	void build(const char *buf, uint32_t len, record_scan_state_t &state);
+
+	void clear() { entries.clear(); cursor = 0; }
+
+	size_t size() const { return entries.size(); }
+
+	// the record at offset, or NULL if it was not indexed; offsets must be looked up in increasing order
+	inline const record_entry_t* find(uint32_t offset) {
+		while (cursor < entries.size() && entries[cursor].offset < offset) ++cursor;
+		if (cursor < entries.size() && entries[cursor].offset == offset) return &entries[cursor];
+		return NULL;
+	}
+
+private:
+	std::vector<record_entry_t> entries;
+	size_t                      cursor;
+};
+
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
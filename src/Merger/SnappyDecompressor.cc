@@ -23,6 +23,8 @@
 #if defined HADOOP_SNAPPY_LIBRARY
 
 snappy_status (*decompressor_func_ptr)(const char*, size_t, char*, size_t*);
+snappy_status (*compressor_func_ptr)(const char*, size_t, char*, size_t*);
+size_t (*max_compressed_length_func_ptr)(size_t);
 
 SnappyDecompressor::SnappyDecompressor(int port, reduce_task_t* reduce_task) :
 		DecompressorWrapper(port, reduce_task), libsnappy(NULL), snappy_loaded(
@@ -40,6 +42,9 @@ void SnappyDecompressor::init() {
 	log(lsTRACE, "snappy init");
 	decompressor_func_ptr = (snappy_status (*)(const char*, size_t, char*,
 			size_t*))loadSymbolWrapper(libsnappy,"snappy_uncompress");
+	compressor_func_ptr = (snappy_status (*)(const char*, size_t, char*,
+			size_t*))loadSymbolWrapper(libsnappy,"snappy_compress");
+	max_compressed_length_func_ptr = (size_t (*)(size_t))loadSymbolWrapper(libsnappy,"snappy_max_compressed_length");
 
 }	/**
 	 * loads snappy library
@@ -86,6 +91,23 @@ void SnappyDecompressor::decompress(const char* compressed_buff,
 	throw new UdaException("Error in snappy decompress function");
 }
 
+size_t SnappyDecompressor::getMaxCompressedLength(size_t uncompressed_len) {
+	return max_compressed_length_func_ptr(uncompressed_len);
+}
+
+size_t SnappyDecompressor::compressBlock(const char* uncompressed_buff,
+		size_t uncompressed_buff_len, char* compressed_buff,
+		size_t compressed_buff_len, void* /* work_mem - not in use for snappy */) {
+
+	snappy_status rc = compressor_func_ptr(uncompressed_buff,
+			uncompressed_buff_len, compressed_buff, &compressed_buff_len);
+	if (rc != SNAPPY_OK) {
+		log(lsERROR, "Error=%d in snappy compress function ", rc);
+		throw new UdaException("Error in snappy compress function");
+	}
+	return compressed_buff_len;
+}
+
 void SnappyDecompressor::get_next_block_length(char* buf,decompressRetData_t* retObj) {
 	uint32_t *tmp = (uint32_t*) buf;
 	retObj->num_uncompressed_bytes = ntohl(tmp[0]);
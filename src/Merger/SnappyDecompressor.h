@@ -35,6 +35,9 @@ class SnappyDecompressor : public DecompressorWrapper
 		SnappyDecompressor(int port, reduce_task_t* reduce_task);
 		virtual ~SnappyDecompressor();
 
+		size_t getMaxCompressedLength(size_t uncompressed_len);
+		size_t compressBlock(const char* uncompressed_buff, size_t uncompressed_buff_len, char* compressed_buff, size_t compressed_buff_len, void *work_mem);
+
 	private:
 
 		void init();
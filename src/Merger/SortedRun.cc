@@ -0,0 +1,150 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#include <algorithm>
+
+#include "SortedRun.h"
+#include "reducer.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+SortedRunSegment::SortedRunSegment(reduce_task *_task, SegmentMergeQueue *merge_queue, size_t num_records) :
+	BaseSegment(NULL), task(_task), next_record(0)
+{
+	records.reserve(num_records);
+
+	// every segment already holds its first record (see MergeQueue::insert)
+	while (merge_queue->size() > 0) {
+		BaseSegment *segment = merge_queue->pop();
+		segments.push_back(segment);
+
+		int ret;
+		do {
+			sort_record_t record;
+			record.prefix = segment->key_prefix;
+			record.key = segment->key.getData();
+			record.key_len = segment->cur_key_len;
+			record.val = segment->val.getData();
+			record.raw = segment->raw_record;
+			record.val_len = segment->cur_val_len;
+			record.kbytes = segment->kbytes;
+			record.vbytes = segment->vbytes;
+			records.push_back(record);
+		} while ((ret = segment->nextKV()) == 1);
+
+		if (ret < 0) {
+			log(lsERROR, "map output is not resident in its fetched buffer");
+			throw new UdaException("map output is not resident in its fetched buffer");
+		}
+	}
+
+	// the sorted run is inserted into the same queue: start its structure over
+	merge_queue->clear();
+
+	sort_records();
+	log(lsINFO, "sorted %d records of %d resident map outputs", (int)records.size(), (int)segments.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+SortedRunSegment::~SortedRunSegment()
+{
+	for (size_t i = 0; i < segments.size(); ++i) {
+		delete segments[i];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int SortedRunSegment::nextKV()
+{
+	if (next_record == records.size()) {
+		eof = true;
+		return 0;
+	}
+	sort_record_t &record = records[next_record++];
+	cur_key_len = record.key_len;
+	cur_val_len = record.val_len;
+	kbytes = record.kbytes;
+	vbytes = record.vbytes;
+	set_key(record.key, record.key_len, record.prefix);
+	val.reset(record.val, record.val_len);
+	raw_record = record.raw;
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+static bool record_less(const SortedRunSegment::sort_record_t &a, const SortedRunSegment::sort_record_t &b)
+{
+	return g_cmp_func(a.key, a.key_len, b.key, b.key_len) < 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// LSD radix sort on the prefixes, one byte per pass, skipping the bytes that all
+// prefixes share; then the compare func orders the runs of equal prefixes
+void SortedRunSegment::sort_records()
+{
+	size_t n = records.size();
+	if (n < 2) return;
+
+	uint64_t all_or = 0, all_and = ~0ULL;
+	for (size_t i = 0; i < n; ++i) {
+		all_or |= records[i].prefix;
+		all_and &= records[i].prefix;
+	}
+	uint64_t varying = all_or ^ all_and;
+
+	std::vector<sort_record_t> buf(n);
+	std::vector<sort_record_t> *from = &records, *to = &buf;
+	for (int shift = 0; shift < 64; shift += 8) {
+		if (!((varying >> shift) & 0xff)) continue;
+
+		size_t count[257] = {0};
+		for (size_t i = 0; i < n; ++i) {
+			count[((*from)[i].prefix >> shift & 0xff) + 1]++;
+		}
+		for (int d = 0; d < 256; ++d) {
+			count[d + 1] += count[d];
+		}
+		for (size_t i = 0; i < n; ++i) {
+			(*to)[count[(*from)[i].prefix >> shift & 0xff]++] = (*from)[i];
+		}
+		std::swap(from, to);
+	}
+	if (from != &records) {
+		records.swap(buf);
+	}
+
+	for (size_t start = 0; start < n; ) {
+		size_t end = start + 1;
+		while (end < n && records[end].prefix == records[start].prefix) ++end;
+		if (end - start > 1) {
+			std::stable_sort(records.begin() + start, records.begin() + end, record_less);
+		}
+		start = end;
+	}
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -0,0 +1,85 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#ifndef SORTED_RUN_H
+#define SORTED_RUN_H
+
+#include <vector>
+
+#include "MergeManager.h"
+
+struct reduce_task;
+
+#define SORT_RESIDENT_MAX_BYTES "134217728" // 128MB of map outputs
+#define SORT_RESIDENT_MAX_RECORDS "1048576" // 96MB of sort_record_t: the records and the radix sort's buffer
+
+/*
+ * A merge of map outputs that are all resident in their fetched buffers, done as a
+ * single sort of their records: a radix sort on the key prefixes, then the compare
+ * func only within runs of equal prefixes.  Serves the sorted records as a single
+ * segment, so the usual merge loop streams them to Java.
+ */
+class SortedRunSegment : public BaseSegment
+{
+public:
+	// takes all the segments of merge_queue, which must have no more data to fetch,
+	// and leaves it empty for inserting this segment.  num_records is their expected
+	// number of records, for allocating the records at once
+	SortedRunSegment(reduce_task *_task, SegmentMergeQueue *merge_queue, size_t num_records);
+	virtual ~SortedRunSegment(); // also deletes the taken segments
+
+	virtual int  nextKV();
+	virtual bool switch_mem() {return false;}
+	virtual bool reset_data() {return false;}
+	virtual void send_request() {}
+	virtual reduce_task *get_task() {return task;}
+	virtual bool next_in_place() {return next_record < records.size();} // the buffers live as long as we do
+
+	size_t num_records() {return records.size();}
+
+	typedef struct sort_record {
+		uint64_t  prefix;
+		char     *key;
+		char     *val;
+		char     *raw; // see BaseSegment::raw_record
+		int32_t   key_len;
+		int32_t   val_len;
+		int32_t   kbytes;
+		int32_t   vbytes;
+	} sort_record_t;
+
+private:
+	void sort_records();
+
+	reduce_task                *task;
+	std::vector<BaseSegment*>   segments;
+	std::vector<sort_record_t>  records;
+	size_t                      next_record;
+};
+
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/mman.h>
 
 
 #include "MergeManager.h"
@@ -37,6 +38,8 @@
 #include "StreamRW.h"
 #include "IOUtility.h"
 #include "reducer.h"
+#include "DecompressorWrapper.h"
+#include "NativeCombiner.h"
 #include "bullseye.h"
 
 using namespace std;
@@ -48,6 +51,9 @@ MapOutput::MapOutput(struct reduce_task *task) : KVOutput(task)
 {
     this->part_req = NULL;
     this->fetch_count = 0;
+    this->scan_state.init();
+    this->checksum = 0;
+    this->checksum_refetches = 0;
 
    	pthread_mutex_lock(&task->lock);
   	mop_id = this->task->mop_index++;
@@ -148,9 +154,61 @@ KVOutput::~KVOutput()
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-bool write_kv_to_stream(SegmentMergeQueue *records, int32_t len,
-		OutStream *stream, int32_t &total_write) {
-    int32_t key_len, val_len, bytes_write;
+// advance the merge to its next record (or re-take the pending one - see mergeq_flag)
+static bool next_record(SegmentMergeQueue *records) {
+    if (!records->next()) return false;
+
+    if (records->min_segment->get_task()->isCompressionOn()){
+        MapOutput *mop = dynamic_cast<MapOutput*>(records->min_segment->getKVOUutput());
+        if(mop!=NULL){
+            //passing NULL and 0 since those variables are needed for RDMA client and not decomressore wrapper
+            records->min_segment->get_task()->client->start_fetch_req(mop->part_req, NULL, 0);
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// folds the values of all the records that have the current key into acc (with g_combiner).
+// the key is copied to key_buf since the merge moves on.
+// returns true when the merge stopped on a record of the next key, which is left pending.
+static bool combine_equal_keys(SegmentMergeQueue *records, std::string &key_buf, char *acc) {
+    DataStream *k = records->getKey();
+    key_buf.assign(k->getData(), records->get_key_len());
+    const uint64_t prefix = records->min_segment->key_prefix;
+    memcpy(acc, records->getVal()->getData(), g_combiner->val_len);
+
+    records->mergeq_flag = 0;
+    while (next_record(records)) {
+        if (records->min_segment->key_prefix != prefix ||
+            g_cmp_func(records->getKey()->getData(), records->get_key_len(), (char*)key_buf.data(), key_buf.length()) != 0) {
+            records->mergeq_flag = 1; // first record of the next key
+            return true;
+        }
+        if (records->get_val_len() != g_combiner->val_len) {
+            log(lsERROR, "native combiner %s expects values of %d bytes, got %d", g_combiner->name, g_combiner->val_len, records->get_val_len());
+            throw new UdaException("value size does not match the native combiner");
+        }
+        g_combiner->combine(acc, records->getVal()->getData());
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// writes the records that were gathered as one span of a segment buffer
+static inline void flush_span(OutStream *stream, char *&span, int64_t &span_len) {
+    if (span_len) {
+        stream->write(span, span_len);
+    }
+    span = NULL;
+    span_len = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool write_kv_to_stream(SegmentMergeQueue *records, int64_t len,
+		OutStream *stream, int64_t &total_write, SpillKeyIndex *index = NULL, bool write_eof = true) {
+    int32_t key_len, val_len;
+    int64_t bytes_write;
     int32_t kbytes, vbytes;
     int32_t record_len;
 
@@ -158,15 +216,15 @@ bool write_kv_to_stream(SegmentMergeQueue *records, int32_t len,
     key_len = val_len = kbytes = vbytes = 0;
     log(lsDEBUG, ">>>> started");
 
-    while (records->next()) {
-    	 if (records->min_segment->get_task()->isCompressionOn()){
-			MapOutput *mop = dynamic_cast<MapOutput*>(records->min_segment->getKVOUutput());
-			if(mop!=NULL){
-				//passing NULL and 0 since those variables are needed for RDMA client and not decomressore wrapper
-				records->min_segment->get_task()->client->start_fetch_req(mop->part_req, NULL, 0);
-			}
-		}
+    std::string combined_key;
+    char combined_val[sizeof(int64_t)];
+
+    // records are copied as they were serialized in the segment buffers (the same IFile
+    // layout we write), consecutive records of a buffer with a single copy
+    char    *span = NULL;
+    int64_t  span_len = 0;
 
+    while (next_record(records)) {
         //log(lsTRACE, "in loop i=%d", i++);
         DataStream *k = records->getKey();
         DataStream *v = records->getVal();
@@ -174,6 +232,11 @@ bool write_kv_to_stream(SegmentMergeQueue *records, int32_t len,
 		key_len = records->get_key_len();
 		val_len = records->get_val_len();
 
+		if (g_combiner && val_len != g_combiner->val_len) {
+			log(lsERROR, "native combiner %s expects values of %d bytes, got %d", g_combiner->name, g_combiner->val_len, val_len);
+			throw new UdaException("value size does not match the native combiner");
+		}
+
 		BULLSEYE_EXCLUDE_BLOCK_START
         if (key_len < 0 || val_len < 0) {
             log(lsERROR, "key_len or val_len < 0");
@@ -187,12 +250,51 @@ bool write_kv_to_stream(SegmentMergeQueue *records, int32_t len,
 
         record_len = kbytes + vbytes + key_len + val_len;
         if ( record_len + bytes_write > len ) {
+            flush_span(stream, span, span_len);
             total_write = bytes_write;
             records->mergeq_flag = 1;
             log(lsDEBUG, "return false because record_len + bytes_write > len");
             return false;
         }
 
+        BaseSegment *segment = records->min_segment;
+        if (!g_combiner && segment->raw_record) {
+            if (span + span_len != segment->raw_record) {
+                flush_span(stream, span, span_len);
+                span = segment->raw_record;
+            }
+            if (index) {
+                index->sample(bytes_write, k->getData(), key_len);
+            }
+            span_len += record_len;
+            bytes_write += record_len;
+            records->mergeq_flag = 0;
+            if (!segment->next_in_place()) {
+                flush_span(stream, span, span_len); // the span may not survive the next record
+            }
+            continue;
+        }
+        flush_span(stream, span, span_len);
+
+        if (g_combiner) {
+            // the combined record has the same size, hence it fits as well
+            bool more = combine_equal_keys(records, combined_key, combined_val);
+            if (index) {
+                index->sample(bytes_write, combined_key.data(), key_len);
+            }
+            StreamUtility::serializeInt(key_len, *stream);
+            StreamUtility::serializeInt(val_len, *stream);
+            stream->write(combined_key.data(), key_len);
+            stream->write(combined_val, val_len);
+            bytes_write += record_len;
+            if (!more) break; // merge exhausted
+            continue; // mergeq_flag is left on the pending record of the next key
+        }
+
+        if (index) {
+            index->sample(bytes_write, k->getData(), key_len);
+        }
+
         StreamUtility::serializeInt(key_len, *stream);
         StreamUtility::serializeInt(val_len, *stream);
         stream->write(k->getData(), key_len);
@@ -201,6 +303,14 @@ bool write_kv_to_stream(SegmentMergeQueue *records, int32_t len,
         records->mergeq_flag   = 0;
         // output_stdout(" << %s: in loop tail <-", __func__);
     }
+    flush_span(stream, span, span_len);
+
+    if (!write_eof) { // more data of the same stream follows (i.e. next key range)
+        records->mergeq_flag = 0;
+        total_write = bytes_write;
+        log(lsDEBUG, "<<<< finished without EOF marker");
+        return true;
+    }
 
 	/* test for last -1, -1 */
 	kbytes = StreamUtility::getVIntSize(EOF_MARKER);
@@ -228,10 +338,12 @@ bool write_kv_to_stream(SegmentMergeQueue *records, int32_t len,
 
 
 bool write_kv_to_mem(SegmentMergeQueue *records, char *src, int32_t len,
-		int32_t &total_write) {
+		int32_t &total_write, bool write_eof) {
     DataStream *stream = new DataStream(src, len);
 
-    bool ret = write_kv_to_stream(records, len, stream, total_write);
+    int64_t bytes_write;
+    bool ret = write_kv_to_stream(records, len, stream, bytes_write, NULL, write_eof);
+    total_write = (int32_t)bytes_write; // never more than len
 
     delete stream;
     return ret;
@@ -265,6 +377,8 @@ BaseSegment::BaseSegment(KVOutput *kvOutput) {
     this->kbytes = 0;
     this->vbytes = 0;
     this->byte_read = 0;
+    this->key_prefix = 0;
+    this->raw_record = NULL;
 
 	this->kv_output = kvOutput;
 	mem_desc_t *mem;
@@ -339,28 +453,42 @@ int BaseSegment::nextKVInternal(InStream *stream) {
 	if (!stream){
 		return 0;
 	}
-    
-    int digested = 0;
 
-    /* key length */
+	// the record is decoded in place; nothing is consumed until it is all there
+	DataStream *data = (DataStream*)stream;
+	char   *mem = data->getCurrent();
+	size_t  avail = data->getAvailable();
+
+	/* the record was already decoded by the fetch thread */
+	const record_entry_t *entry = find_indexed_record(mem);
+	if (entry) {
+		int header = entry->kbytes + entry->vbytes;
+		total_read = header + entry->key_len + entry->val_len;
+		if ((size_t)total_read <= avail) {
+			cur_key_len = entry->key_len;
+			cur_val_len = entry->val_len;
+			kbytes = entry->kbytes;
+			vbytes = entry->vbytes;
+			this->set_key(mem + header, cur_key_len, entry->prefix);
+			this->val.reset(mem + header + cur_key_len, cur_val_len);
+			this->raw_record = mem;
+			data->advance(total_read);
+			byte_read += total_read;
+			cur_buf->incStart(total_read);
+			return 1;
+		}
+	}
 
-    bool k = StreamUtility::deserializeInt(*stream, cur_key_len, &kbytes);
-	if (!k){
+    /* key length + value length */
+	int header = StreamUtility::decodeKVHeader(mem, avail, cur_key_len, cur_val_len, kbytes, vbytes);
+	if (!header){
 		return -1;
 	}
 
-    digested += kbytes;
-
-    /* value length */
-    bool v = StreamUtility::deserializeInt(*stream, cur_val_len, &vbytes);
-    if (!v) {
-        stream->rewind(digested);
-        return -1;
-    }
-    digested += vbytes;
 	if (cur_key_len == EOF_MARKER && cur_val_len == EOF_MARKER) {
         eof = true;
-        total_read = kbytes + vbytes;
+        data->advance(header);
+        total_read = header;
         byte_read += total_read;
         cur_buf->incStart(total_read);
         return 0;
@@ -368,35 +496,22 @@ int BaseSegment::nextKVInternal(InStream *stream) {
 
     /* Making a sanity check */
     if (cur_key_len < 0 || cur_val_len < 0) {
-		output_stderr("Reader:Error in nextKV");
-		eof = true;
-		total_read = kbytes + vbytes;
-		byte_read += total_read;
-		cur_buf->incStart(total_read);
-        return 0;
+		log(lsERROR, "Reader: corrupted record (key_len=%d, val_len=%d) at offset %lld of map output",
+				cur_key_len, cur_val_len, (long long)byte_read);
+		throw new UdaException("Reader: corrupted record in map output");
     }
 
     /* no enough for key + val */
-    if (!stream->hasMore(cur_key_len + cur_val_len)) {
-    	stream->rewind(digested);
+    if ((size_t)cur_key_len + cur_val_len > avail - header) {
         return -1;
     }
 
-    int   pos = -1;
-    char *mem = NULL;
-
-    /* key */
-    pos = ((DataStream*)stream)->getPosition();
-    mem = ((DataStream*)stream)->getData();
-    this->key.reset(mem + pos, cur_key_len);
-    stream->skip(cur_key_len);
-
-    /* val */
-    pos = ((DataStream*)stream)->getPosition();
-    mem = ((DataStream*)stream)->getData();
-    this->val.reset(mem + pos, cur_val_len);
-    stream->skip(cur_val_len);
-    total_read = kbytes + vbytes + cur_key_len + cur_val_len;
+    /* key, val */
+    this->set_key(mem + header, cur_key_len);
+    this->val.reset(mem + header + cur_key_len, cur_val_len);
+    this->raw_record = mem;
+    total_read = header + cur_key_len + cur_val_len;
+    data->advance(total_read);
     byte_read += total_read;
     cur_buf->incStart(total_read);
     return 1;
@@ -448,6 +563,22 @@ int BaseSegment::nextKV() {
     return 0;
 }
 
+// a complete record (not the EOF marker) starts at p
+static inline bool record_complete(const char *p, size_t avail) {
+	int32_t key_len, val_len, kbytes, vbytes;
+	int header = StreamUtility::decodeKVHeader(p, avail, key_len, val_len, kbytes, vbytes);
+	return header && key_len >= 0 && val_len >= 0 && (size_t)key_len + val_len <= avail - header;
+}
+
+// otherwise the next nextKV() may switch the buffer (and request new data into the current one)
+// or reach the end (and return the buffers to the pool).
+// With compression, the decompressor refills the space of the consumed records meanwhile,
+// so each record is copied before the next one is read.
+bool BaseSegment::next_in_place() {
+	return kv_output && in_mem_data && kv_output->task->isCompressionOff() &&
+			record_complete(in_mem_data->getCurrent(), in_mem_data->getAvailable());
+}
+
 
 void BaseSegment::close() {
 	BULLSEYE_EXCLUDE_BLOCK_START
@@ -621,7 +752,7 @@ bool BaseSegment::join(char *src, const int32_t src_len) {
         char *mem = NULL;
         pos = in_mem_data->getPosition();
         mem = in_mem_data->getData();
-        key.reset(mem + pos,  cur_key_len);
+        set_key(mem + pos,  cur_key_len);
         val.reset(mem + pos + cur_key_len, cur_val_len);
         in_mem_data->skip(cur_key_len + cur_val_len);
         byte_read += (kbytes + vbytes + cur_key_len + cur_val_len);
@@ -653,7 +784,7 @@ bool BaseSegment::join(char *src, const int32_t src_len) {
         /* Copying from the new partition */
         memcpy(temp_kv + part_len, src, shift_len);
         in_mem_data->reset(src + shift_len, src_len - shift_len);
-        key.reset(temp_kv, cur_key_len);
+        set_key(temp_kv, cur_key_len);
         val.reset(temp_kv + cur_key_len, cur_val_len);
         byte_read += (kbytes + vbytes + cur_key_len + cur_val_len);
         return true;
@@ -810,30 +941,148 @@ AioSegment::~AioSegment() {
 ;}
 #endif
 
-SuperSegment::SuperSegment(reduce_task *_task, const std::string &_path) :
-	Segment(NULL), task(_task), path(_path) {
+SuperSegment::SuperSegment(reduce_task *_task, const std::string &_path, DecompressorWrapper *codec) :
+	Segment(NULL), task(_task), path(_path),
+	remove_on_close(true), has_lower_key(false), has_upper_key(false),
+	map_addr(NULL), map_len(0), map_pos(0), map_released(0) {
+	open_file(codec);
+}
+
+SuperSegment::SuperSegment(reduce_task *_task, const std::string &_path, int64_t start_offset,
+		const std::string *_lower_key, const std::string *_upper_key, DecompressorWrapper *codec) :
+	Segment(NULL), task(_task), path(_path),
+	remove_on_close(false), has_lower_key(_lower_key != NULL), has_upper_key(_upper_key != NULL),
+	map_addr(NULL), map_len(0), map_pos(0), map_released(0) {
+	if (_lower_key) lower_key = *_lower_key;
+	if (_upper_key) upper_key = *_upper_key;
+
+	open_file(codec);
+	if (!this->file || start_offset <= 0) return;
+
+	if (map_addr) {
+		map_pos = min((size_t)start_offset, map_len);
+	}
+	else if (codec) {
+		in_stream->skip(start_offset); // offset is of the uncompressed data
+	}
+	else if (fseeko(this->file, start_offset, SEEK_SET)) {
+		log(lsERROR, "Reader:cannot seek to offset %lld of file: %s (errno=%m)", (long long)start_offset, path.c_str());
+		throw new UdaException("Reader:cannot seek in file");
+	}
+}
+
+void SuperSegment::open_file(DecompressorWrapper *codec) {
     this->file = fopen(path.c_str(), "rb");
     if (this->file == NULL) {
 		output_stderr("Reader:cannot open file: %s", path.c_str())
 ;		this->file_stream = NULL;
+		this->in_stream = NULL;
         return;
     }
     this->file_stream = new FileStream(this->file);
+    this->in_stream = codec ? (InStream*) new CompressedInStream(this->file_stream, codec) : this->file_stream;
+    if (!codec) map_file();
+}
+
+bool SuperSegment::map_file() {
+	struct stat st;
+	if (fstat(fileno(this->file), &st) || st.st_size == 0) return false;
+
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(this->file), 0);
+	if (addr == MAP_FAILED) {
+		log(lsWARN, "Reader: cannot mmap file: %s (errno=%m) - reading it through stdio", path.c_str());
+		return false;
+	}
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+	map_addr = (char*)addr;
+	map_len = st.st_size;
+	return true;
 }
 
 SuperSegment::~SuperSegment() {
+    if (map_addr) munmap(map_addr, map_len);
     if (this->file_stream != NULL) {
+        if (this->in_stream != this->file_stream)
+            delete this->in_stream;
         delete this->file_stream;
         fclose(this->file);
-        remove(this->path.c_str());
+        if (remove_on_close)
+        	remove(this->path.c_str());
     }
 }
 
-
 int SuperSegment::nextKV() {
+	int ret = readKV();
+
+	// skip the records that precede our key range (we seeked to a sampled record before it)
+	while (ret == 1 && has_lower_key) {
+		if (g_cmp_func(key.getData(), key.getLength(), (char*)lower_key.data(), lower_key.length()) >= 0) {
+			has_lower_key = false;
+			break;
+		}
+		ret = readKV();
+	}
+
+	if (ret == 1 && has_upper_key &&
+		g_cmp_func(key.getData(), key.getLength(), (char*)upper_key.data(), upper_key.length()) >= 0) {
+		eof = true; // the rest of the file belongs to the next key ranges
+		return 0;
+	}
+	return ret;
+}
+
+// the mapping is released when the segment ends, which the upper key may do at any record
+bool SuperSegment::next_in_place() {
+	return map_addr && !has_upper_key && map_pos < map_len && record_complete(map_addr + map_pos, map_len - map_pos);
+}
+
+int SuperSegment::readMappedKV() {
+	if (map_pos >= map_len) {
+		log(lsERROR, "Reader: no EOF marker at end of file: %s", path.c_str());
+		throw new UdaException("Reader: no EOF marker at end of spill file");
+	}
+
+	int header = StreamUtility::decodeKVHeader(map_addr + map_pos, map_len - map_pos, cur_key_len, cur_val_len, kbytes, vbytes);
+	if (!header) {
+		log(lsERROR, "Reader: truncated record header at offset %llu of file: %s", (unsigned long long)map_pos, path.c_str());
+		throw new UdaException("Reader: truncated record header in spill file");
+	}
+	map_pos += header;
+
+	if (cur_key_len == EOF_MARKER && cur_val_len == EOF_MARKER) {
+		eof = true;
+		return 0;
+	}
+	size_t total = (size_t)cur_key_len + cur_val_len;
+	if (cur_key_len < 0 || cur_val_len < 0 || total > map_len - map_pos) {
+		log(lsERROR, "Reader: corrupted record (key_len=%d, val_len=%d) at offset %llu of file: %s",
+				cur_key_len, cur_val_len, (unsigned long long)map_pos, path.c_str());
+		throw new UdaException("Reader: corrupted record in spill file");
+	}
+
+	set_key(map_addr + map_pos, cur_key_len);
+	val.reset(map_addr + map_pos + cur_key_len, cur_val_len);
+	raw_record = map_addr + map_pos - header;
+	map_pos += total;
+
+	// drop the pages that were already merged, so a big spill does not push other data out of memory
+	if (map_pos - map_released >= SPILL_MMAP_RELEASE_SIZE) {
+		size_t page_mask = ~((size_t)getpagesize() - 1);
+		size_t release_end = (map_pos - total) & page_mask; // keep the current record
+		if (release_end > map_released) {
+			madvise(map_addr + map_released, release_end - map_released, MADV_DONTNEED);
+			map_released = release_end;
+		}
+	}
+	return 1;
+}
+
+int SuperSegment::readKV() {
+	if (map_addr) return readMappedKV();
+
 	int dummy;
-    StreamUtility::deserializeInt(*file_stream, cur_key_len, &dummy);//AVNER: TODO
-    StreamUtility::deserializeInt(*file_stream, cur_val_len, &dummy);
+    StreamUtility::deserializeInt(*in_stream, cur_key_len, &dummy);//AVNER: TODO
+    StreamUtility::deserializeInt(*in_stream, cur_val_len, &dummy);
     kbytes = StreamUtility::getVIntSize(cur_key_len);
     vbytes = StreamUtility::getVIntSize(cur_val_len);
 
@@ -854,33 +1103,354 @@ int SuperSegment::nextKV() {
 			temp_kv = (char *) malloc(temp_kv_len * sizeof(char));
         }
     }
-    file_stream->read(temp_kv, total);
-    key.reset(temp_kv, cur_key_len);
+    in_stream->read(temp_kv, total);
+    set_key(temp_kv, cur_key_len);
     val.reset(temp_kv + cur_key_len, cur_val_len);
     return 1;
 }
 
 bool write_kv_to_file(SegmentMergeQueue *records, FILE *f,
-		int32_t &total_write) {
+		int64_t &total_write, SpillKeyIndex *index, DecompressorWrapper *codec) {
     FileStream *stream = new FileStream(f);
-    int32_t len = INT32_MAX; //1<<30; //TODO: consider 64 bit - AVNER
+    CompressedOutStream *compressed_stream = codec ? new CompressedOutStream(stream, codec) : NULL;
+    int64_t len = INT64_MAX;
 
-    bool ret = write_kv_to_stream(records, len, stream, total_write);
+    bool ret = write_kv_to_stream(records, len, compressed_stream ? (OutStream*)compressed_stream : stream, total_write, index);
 
-    stream->flush();
+    if (compressed_stream) {
+        compressed_stream->flush(); // also flushes the file stream
+        delete compressed_stream;
+    }
+    else {
+        stream->flush();
+    }
     delete stream;
     return ret;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+#define BLOCK_HEADER_SIZE 8 // <uncompressed len><compressed len>
+
+CompressedOutStream::CompressedOutStream(OutStream *_sink, DecompressorWrapper *_codec, size_t _block_size) :
+	sink(_sink), codec(_codec), block_size(_block_size), block_len(0) {
+	block = (char*) malloc(block_size);
+	compressed_size = BLOCK_HEADER_SIZE + codec->getMaxCompressedLength(block_size);
+	compressed = (char*) malloc(compressed_size);
+	size_t work_mem_size = codec->getCompressWorkMemSize();
+	work_mem = work_mem_size ? (char*) malloc(work_mem_size) : NULL;
+	if (!block || !compressed || (work_mem_size && !work_mem)) {
+		log(lsERROR, "failed to allocate compression buffers for block size=%lu", (unsigned long)block_size);
+		throw new UdaException("failed to allocate compression buffers");
+	}
+}
+
+CompressedOutStream::~CompressedOutStream() {
+	free(block);
+	free(compressed);
+	free(work_mem);
+}
+
+size_t CompressedOutStream::write(const void *buf, size_t len) {
+	const char *src = (const char*) buf;
+	size_t left = len;
+	while (left) {
+		size_t n = min(left, block_size - block_len);
+		memcpy(block + block_len, src, n);
+		block_len += n;
+		src += n;
+		left -= n;
+		if (block_len == block_size)
+			write_block();
+	}
+	return len;
+}
+
+void CompressedOutStream::write_block() {
+	if (!block_len) return;
+	size_t comp_len = codec->compressBlock(block, block_len, compressed + BLOCK_HEADER_SIZE, compressed_size - BLOCK_HEADER_SIZE, work_mem);
+	uint32_t *header = (uint32_t*) compressed;
+	header[0] = htonl((uint32_t)block_len);
+	header[1] = htonl((uint32_t)comp_len);
+	sink->write(compressed, BLOCK_HEADER_SIZE + comp_len);
+	block_len = 0;
+}
+
+void CompressedOutStream::flush() {
+	write_block();
+	sink->flush();
+}
+
+AioFileOutStream::AioFileOutStream(const char *_file_name, AIOHandler *_aio, size_t _buf_size) :
+	file_name(_file_name), aio(_aio), buf_size(_buf_size), cur_buf(0), cur_len(0), file_offset(0), closed(false), write_status(0) {
+
+	fd = open(_file_name, O_DIRECT | O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0 && errno == EINVAL) {
+		// file system without O_DIRECT support (i.e. tmpfs) - AIO still works on the page cache
+		log(lsWARN, "O_DIRECT is not supported for file %s - writing it without O_DIRECT", _file_name);
+		fd = open(_file_name, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	}
+	if (fd < 0) {
+		log(lsERROR, "Fail to open file %s\t(errno=%m)", _file_name);
+		throw new UdaException("Fail to open file");
+	}
+
+	for (int i = 0; i < NUM_STAGE_MEM; ++i) {
+		if (posix_memalign((void**)&bufs[i].buff, AIO_ALIGNMENT, buf_size)) {
+			log(lsERROR, "failed to allocate aligned spill buffer of %lu bytes", (unsigned long)buf_size);
+			throw new UdaException("failed to allocate aligned spill buffer");
+		}
+		bufs[i].in_flight = false;
+		bufs[i].status = 0;
+		pthread_mutex_init(&bufs[i].lock, NULL);
+		pthread_cond_init(&bufs[i].cond, NULL);
+	}
+}
+
+AioFileOutStream::~AioFileOutStream() {
+	if (!closed) { // an error is on the way: only make sure that no write uses the buffers
+		for (int i = 0; i < NUM_STAGE_MEM; ++i) {
+			wait_write(&bufs[i]);
+		}
+		::close(fd);
+	}
+	for (int i = 0; i < NUM_STAGE_MEM; ++i) {
+		free(bufs[i].buff);
+		pthread_mutex_destroy(&bufs[i].lock);
+		pthread_cond_destroy(&bufs[i].cond);
+	}
+}
+
+/*static*/ int AioFileOutStream::write_completion_handler(void *data, int status) {
+	WriteBuffer *buf = (WriteBuffer*)data;
+	pthread_mutex_lock(&buf->lock);
+	buf->status = status;
+	buf->in_flight = false;
+	pthread_cond_broadcast(&buf->cond);
+	pthread_mutex_unlock(&buf->lock);
+	return 0;
+}
+
+void AioFileOutStream::wait_write(WriteBuffer *buf) {
+	pthread_mutex_lock(&buf->lock);
+	while (buf->in_flight)
+		pthread_cond_wait(&buf->cond, &buf->lock);
+	int status = buf->status;
+	buf->status = 0;
+	pthread_mutex_unlock(&buf->lock);
+
+	if (status < 0) {
+		errno = -status;
+		log(lsERROR, "AIO write of file %s failed: offset=%llu size=%lu (errno=%m)", file_name.c_str(), (unsigned long long)buf->offset, (unsigned long)buf->size);
+	}
+	else if (status > 0) {
+		log(lsERROR, "short AIO write of file %s: offset=%llu size=%lu written=%lu", file_name.c_str(), (unsigned long long)buf->offset, (unsigned long)buf->size, (unsigned long)(buf->size - status));
+	}
+	if (status && !write_status) {
+		write_status = status;
+	}
+}
+
+void AioFileOutStream::wait_buffer(WriteBuffer *buf) {
+	wait_write(buf);
+	if (write_status) {
+		throw new UdaException("AioFileOutStream: write error");
+	}
+}
+
+void AioFileOutStream::submit_buffer(size_t size) {
+	WriteBuffer *buf = &bufs[cur_buf];
+	buf->in_flight = true; // no completion is pending on this buffer - no need for lock
+	buf->offset = file_offset;
+	buf->size = size;
+
+	if (aio->prepare_write(fd, file_offset, size, buf->buff, buf) < 0 || aio->submit() < 0) {
+		log(lsERROR, "failed to submit AIO write of file %s: offset=%llu size=%lu", file_name.c_str(), (unsigned long long)file_offset, (unsigned long)size);
+		buf->in_flight = false;
+		throw new UdaException("failed to submit AIO write");
+	}
+	file_offset += size;
+
+	// continue filling the other buffer once its previous write completed
+	cur_buf = (cur_buf + 1) % NUM_STAGE_MEM;
+	cur_len = 0;
+	wait_buffer(&bufs[cur_buf]);
+}
+
+size_t AioFileOutStream::write(const void *buf, size_t len) {
+	const char *src = (const char*) buf;
+	size_t left = len;
+	while (left) {
+		size_t n = min(left, buf_size - cur_len);
+		memcpy(bufs[cur_buf].buff + cur_len, src, n);
+		cur_len += n;
+		src += n;
+		left -= n;
+		if (cur_len == buf_size)
+			submit_buffer(buf_size);
+	}
+	return len;
+}
+
+bool AioFileOutStream::close() {
+	if (closed) return true;
+
+	uint64_t file_len = file_offset + cur_len;
+	if (cur_len) {
+		size_t padded_len = (cur_len + AIO_ALIGNMENT - 1) & ~((size_t)AIO_ALIGNMENT - 1);
+		memset(bufs[cur_buf].buff + cur_len, 0, padded_len - cur_len);
+		submit_buffer(padded_len);
+	}
+	for (int i = 0; i < NUM_STAGE_MEM; ++i) {
+		wait_write(&bufs[i]); // all writes are done before we throw
+	}
+
+	bool ret = true;
+	if (!write_status && ftruncate(fd, file_len)) { // drop the alignment padding
+		log(lsERROR, "failed to truncate file %s to %llu bytes (errno=%m)", file_name.c_str(), (unsigned long long)file_len);
+		ret = false;
+	}
+	closed = true;
+	::close(fd);
+	if (write_status) {
+		throw new UdaException("AioFileOutStream: write error");
+	}
+	return ret;
+}
+
+CompressedInStream::CompressedInStream(InStream *_source, DecompressorWrapper *_codec) :
+	source(_source), codec(_codec), block(NULL), block_size(0), block_len(0), block_pos(0),
+	compressed(NULL), compressed_size(0) {
+}
+
+CompressedInStream::~CompressedInStream() {
+	free(block);
+	free(compressed);
+}
+
+void CompressedInStream::read_header(uint32_t &uncompressed_len, uint32_t &compressed_len) {
+	uint32_t header[2];
+	source->read(header, BLOCK_HEADER_SIZE); // throws on EOF - a record never ends beyond the last block
+	uncompressed_len = ntohl(header[0]);
+	compressed_len = ntohl(header[1]);
+}
+
+void CompressedInStream::read_block(uint32_t uncompressed_len, uint32_t compressed_len) {
+	if (compressed_len > compressed_size) {
+		free(compressed);
+		compressed_size = compressed_len;
+		compressed = (char*) malloc(compressed_size);
+	}
+	if (uncompressed_len > block_size) {
+		free(block);
+		block_size = uncompressed_len;
+		block = (char*) malloc(block_size);
+	}
+	if (!compressed || !block) {
+		log(lsERROR, "failed to allocate decompression buffers: compressed_len=%u uncompressed_len=%u", compressed_len, uncompressed_len);
+		throw new UdaException("failed to allocate decompression buffers");
+	}
+
+	source->read(compressed, compressed_len);
+	decompressRetData_t ret;
+	codec->decompressBlock(compressed, block, compressed_len, uncompressed_len, &ret);
+	if (ret.num_uncompressed_bytes != uncompressed_len) {
+		log(lsERROR, "corrupted spill block: expected %u uncompressed bytes, got %u", uncompressed_len, ret.num_uncompressed_bytes);
+		throw new UdaException("corrupted spill block");
+	}
+	block_len = uncompressed_len;
+	block_pos = 0;
+}
+
+size_t CompressedInStream::read(void *buf, size_t len) {
+	char *dst = (char*) buf;
+	size_t left = len;
+	while (left) {
+		if (block_pos == block_len) {
+			uint32_t uncompressed_len, compressed_len;
+			read_header(uncompressed_len, compressed_len);
+			read_block(uncompressed_len, compressed_len);
+		}
+		size_t n = min(left, block_len - block_pos);
+		memcpy(dst, block + block_pos, n);
+		block_pos += n;
+		dst += n;
+		left -= n;
+	}
+	return len;
+}
+
+size_t CompressedInStream::skip(size_t nbytes) {
+	size_t left = nbytes;
+	size_t n = min(left, block_len - block_pos);
+	block_pos += n;
+	left -= n;
+
+	// pass over whole blocks by their headers only
+	while (left) {
+		uint32_t uncompressed_len, compressed_len;
+		read_header(uncompressed_len, compressed_len);
+		if (uncompressed_len > left) {
+			read_block(uncompressed_len, compressed_len);
+			block_pos = left;
+			break;
+		}
+		source->skip(compressed_len);
+		left -= uncompressed_len;
+	}
+	return nbytes;
+}
+
+bool CompressedInStream::hasMore(size_t nbytes) {
+	if (nbytes == 1) return block_pos < block_len || source->hasMore(1);
+	throw new UdaException("CompressedInStream: hasMore not supported");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int64_t SpillKeyIndex::seek_offset(const std::string &key) {
+	// keys were sampled from a sorted file - binary search for the last key < 'key'
+	int lo = 0, hi = (int)keys.size(); // answer is in [lo-1, hi-1]
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (g_cmp_func((char*)keys[mid].data(), keys[mid].length(), (char*)key.data(), key.length()) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo > 0) ? offsets[lo - 1] : 0;
+}
+
 bool write_kv_to_file(SegmentMergeQueue *records, const char *file_name,
-		int32_t &total_write) {
+		int64_t &total_write, SpillKeyIndex *index, DecompressorWrapper *codec, AIOHandler *aio) {
+    if (aio) {
+        AioFileOutStream *stream = new AioFileOutStream(file_name, aio);
+        CompressedOutStream *compressed_stream = codec ? new CompressedOutStream(stream, codec) : NULL;
+        int64_t len = INT64_MAX;
+
+        bool ret;
+        try {
+            ret = write_kv_to_stream(records, len, compressed_stream ? (OutStream*)compressed_stream : stream, total_write, index);
+            if (compressed_stream) {
+                compressed_stream->flush();
+            }
+            stream->close();
+        }
+        catch (UdaException *ex) { // the spill file is not complete
+            delete compressed_stream;
+            delete stream; // waits for the writes that are still in flight
+            throw ex;
+        }
+        delete compressed_stream;
+        delete stream;
+        return ret;
+    }
+
     FILE *file = fopen(file_name, "wb");
     if (!file) {
     	log(lsERROR, "[pid=%d] fail to open file(errno=%d: %m)\n", getpid(), errno);
 		throw new UdaException("Fail to open file");
     }
 
-    bool ret = write_kv_to_file(records, file, total_write);
+    bool ret = write_kv_to_file(records, file, total_write, index, codec);
 
     fclose(file);
     return ret;
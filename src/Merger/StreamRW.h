@@ -27,17 +27,19 @@
 
 class MapOutput;
 class RawKeyValueIterator;
+class DecompressorWrapper;
 #include "MergeQueue.h"
 #include "AIOHandler.h"
 #include "CompareFunc.h"
+#include "RecordIndex.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 /**
  * this class takes care for housekeeping for object that were taken out from a
  * pool that is based on the kernel list that we use in UDA.
  *
- * NOTE: at this moment we are not implementing locks around the pools we use.
- * this should be changed if we use multiple LPQs in parallel
+ * NOTE: borrow/return are serialized with an internal lock, since the LPQ fetcher
+ * and the LPQ merge threads use the pool in parallel
  *
  * NOTE: it is your responsibility to return only items that you were previously borrowed from this pool
  */
@@ -54,21 +56,30 @@ public:
 	HouseKeepingPool(struct list_head * basePool, ItemBuildFunc buildFunc, size_t initialCapacity = 10)
 	: m_basePool(basePool), m_buildFunc(buildFunc) {
 		m_houseKeepingPool.reserve(initialCapacity);
+		pthread_mutex_init(&m_lock, NULL);
+	}
+
+	~HouseKeepingPool() {
+		pthread_mutex_destroy(&m_lock);
 	}
 
 	//----------------------
 	T * borrowFromPool(){
+		pthread_mutex_lock(&m_lock);
 	    T *item = list_entry(m_basePool->next, typeof(*item), list);
 	    list_del(&item->list);
 	    m_houseKeepingPool.push_back(item); // for house keeping
+		pthread_mutex_unlock(&m_lock);
 	    return item;
 	}
 
 	//----------------------
 	void returnToPool(void* userData){
+		pthread_mutex_lock(&m_lock);
 		T *item = prepareReturnToPool();
 		m_buildFunc(item, userData);
 		completeReturnToPool(item);
+		pthread_mutex_unlock(&m_lock);
 	}
 
 private:
@@ -85,6 +96,7 @@ private:
 	struct list_head * m_basePool;
 	std::vector<T *>   m_houseKeepingPool;
 	ItemBuildFunc      m_buildFunc;
+	pthread_mutex_t    m_lock;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -123,6 +135,8 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////
 /* MapOutput holds the data from one partition */
+#define IFILE_CHECKSUM_LEN (4) // the CRC-32 trailer of a map output partition
+
 class MapOutput : public KVOutput
 {
 public:
@@ -137,6 +151,12 @@ public:
 
     /* used for testing */
     volatile uint64_t  fetch_count;
+
+    record_scan_state_t scan_state; // for indexing the records of the next fetched buffer
+
+    uint32_t  checksum; // crc32 of the data fetched so far (see MergeManager::mark_req_as_ready)
+    char      checksum_trailer[IFILE_CHECKSUM_LEN];
+    int       checksum_refetches;
 };
 
 class BaseSegment
@@ -160,14 +180,44 @@ public:
     virtual void        close();
     virtual void        send_request() = 0;
     virtual reduce_task *get_task() {return kv_output->task;}
-    bool operator<(BaseSegment &seg) {  return ( (g_cmp_func(key.getData(), key.getLength(), seg.key.getData(), seg.key.getLength())) < 0 ); }
+    // true when the next nextKV() keeps raw_record valid, i.e. the segment stays in its buffer
+    virtual bool        next_in_place();
+    bool operator<(BaseSegment &seg) {
+        if (key_prefix != seg.key_prefix) return key_prefix < seg.key_prefix; // resolves most compares without touching key memory
+        return ( (g_cmp_func(key.getData(), key.getLength(), seg.key.getData(), seg.key.getLength())) < 0 );
+    }
 
 	virtual KVOutput * getKVOUutput() {return kv_output;}
 
 
     DataStream  key;
     DataStream  val;
+    uint64_t    key_prefix; // g_prefix_func of current key
+    char       *raw_record; // the current record as serialized in the segment's buffer; NULL when it was copied (see join)
 protected:
+    // every change of current key must go through here for keeping key_prefix in sync
+    void set_key(char *data, int32_t len) {
+        key.reset(data, len);
+        key_prefix = g_prefix_func(data, len);
+        raw_record = NULL;
+    }
+    void set_key(char *data, int32_t len, uint64_t prefix) {
+        key.reset(data, len);
+        key_prefix = prefix;
+        raw_record = NULL;
+    }
+
+    // the indexed record at mem, if mem is in an indexed buffer of the map output
+    inline const record_entry_t* find_indexed_record(char *mem) {
+        for (int i = 0; i < NUM_STAGE_MEM; ++i) {
+            mem_desc_t *desc = kv_output->mop_bufs[i];
+            if (mem >= desc->buff && mem < desc->buff + desc->buf_len) { // the other buffer may be in indexing
+                return desc->rec_index ? desc->rec_index->find((uint32_t)(mem - desc->buff)) : NULL;
+            }
+        }
+        return NULL;
+    }
+
     virtual int         nextKVInternal(InStream *stream);
     virtual bool        join (char *src, int32_t src_len);
 
@@ -186,7 +236,20 @@ public:
     DataStream  *in_mem_data;
 };
 
-typedef MergeQueue<BaseSegment*> SegmentMergeQueue;
+/* BaseSegment::operator< with the compare func of the key type inlined */
+template <class KeyCompare>
+struct SegmentLess
+{
+    inline bool operator()(BaseSegment *a, BaseSegment *b) const {
+        if (a->key_prefix != b->key_prefix) return a->key_prefix < b->key_prefix;
+        return KeyCompare::compare(a->key.getData(), a->key.getLength(), b->key.getData(), b->key.getLength()) < 0;
+    }
+};
+
+typedef BaseMergeQueue<BaseSegment*> SegmentMergeQueue;
+
+/* a merge queue whose structure is specialized for g_key_compare_kind (see MergeQueue.cc) */
+SegmentMergeQueue* createSegmentMergeQueue(int numMaps, mem_desc_t* staging_descs = NULL, const char* fname = "", ResetElemFunc resetElemFunc = NULL);
 
 
 /* The following is for class Segment */
@@ -213,10 +276,161 @@ protected:
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * Sparse key index of a spill file: the key and offset of the first record
+ * at (roughly) every 'interval' bytes.  Lets a reader seek close to the
+ * first record of a key range instead of scanning the file from its start.
+ */
+class SpillKeyIndex
+{
+public:
+    SpillKeyIndex(int64_t _interval) : interval(_interval), next_sample(0) {}
+
+    // called for every record written; keeps only the sampled ones
+    void sample(int64_t offset, const char *key, int32_t key_len) {
+        if (offset < next_sample) return;
+        offsets.push_back(offset);
+        keys.push_back(std::string(key, key_len));
+        next_sample = offset + interval;
+    }
+
+    // offset of the last sampled record with key < 'key' (0 if none);
+    // all records >= 'key' are located after this offset
+    int64_t seek_offset(const std::string &key);
+
+    std::vector<int64_t>     offsets;
+    std::vector<std::string> keys;
+private:
+    const int64_t interval;
+    int64_t       next_sample;
+};
+
+
+#define SPILL_COMPRESSION_BLOCK_SIZE (256*1024) // uncompressed bytes per block, as hadoop's default codec buffer
+
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * Block compressed output stream for LPQ spill files.  Every block is written as
+ * <uncompressed len (4B BE)><compressed len (4B BE)><compressed data>
+ * - the same block header of the shuffled Lzo/Snappy data.
+ */
+class CompressedOutStream : public OutStream
+{
+public:
+    CompressedOutStream(OutStream *_sink, DecompressorWrapper *_codec, size_t _block_size = SPILL_COMPRESSION_BLOCK_SIZE);
+    ~CompressedOutStream();
+
+    size_t write(const void *buf, size_t len);
+    void   flush(); // compresses the pending data as a (short) block and flushes the sink
+    bool   close() {return true;}
+
+private:
+    void   write_block();
+
+    OutStream           *sink;
+    DecompressorWrapper *codec;
+    const size_t         block_size;
+    char                *block;
+    size_t               block_len;
+    char                *compressed;
+    size_t               compressed_size;
+    char                *work_mem;
+};
+
+/**
+ * Reads a stream written by CompressedOutStream, decompressing a block at a time.
+ * skip() passes over whole blocks by their headers, without decompressing them.
+ */
+class CompressedInStream : public InStream
+{
+public:
+    CompressedInStream(InStream *_source, DecompressorWrapper *_codec);
+    ~CompressedInStream();
+
+    size_t read(void *des, const size_t len, const char *extrasrc, size_t size, int &idx) {
+        throw new UdaException("CompressedInStream: read from two srcs not supported");
+    }
+    size_t read(void *buf, size_t len);
+    size_t skip(size_t nbytes);
+    size_t rewind(size_t nbytes) {throw new UdaException("CompressedInStream: rewind not supported");}
+    bool   hasMore(size_t nbytes);
+    bool   close() {return true;}
+
+private:
+    void   read_header(uint32_t &uncompressed_len, uint32_t &compressed_len);
+    void   read_block(uint32_t uncompressed_len, uint32_t compressed_len); // after its header was read
+
+    InStream            *source;
+    DecompressorWrapper *codec;
+    char                *block;
+    size_t               block_size; // allocated
+    size_t               block_len;
+    size_t               block_pos;
+    char                *compressed;
+    size_t               compressed_size; // allocated
+};
+
+
+#define SPILL_AIO_BUFFER_SIZE (4<<20) // bytes per AIO write of spill output
+#define SPILL_MMAP_RELEASE_SIZE (64<<20) // read bytes of a mapped spill file between releases of its pages
+
+////////////////////////////////////////////////////////////////////////////////
+/**
+ * Spill file output through AIO with O_DIRECT.  Data is gathered into
+ * NUM_STAGE_MEM aligned buffers, and a full buffer is written in one AIO
+ * request while the next one is being filled.
+ * The last buffer is padded to alignment, and close() truncates the padding.
+ * A failed or short write throws UdaException from the next write() or close()
+ * that waits for its buffer.
+ */
+class AioFileOutStream : public OutStream
+{
+public:
+    AioFileOutStream(const char *_file_name, AIOHandler *_aio, size_t _buf_size = SPILL_AIO_BUFFER_SIZE);
+    ~AioFileOutStream();
+
+    size_t write(const void *buf, size_t len);
+    void   flush() {} // only whole buffers are written before close()
+    bool   close();   // writes the pending data and waits for all writes; throws if any failed
+
+    // AIOHandler callback of all spill writes
+    static int write_completion_handler(void *data, int status);
+
+private:
+    struct WriteBuffer {
+        char            *buff;
+        bool             in_flight;
+        int              status; // of its last write (see AIOHandler::prepare_write)
+        uint64_t         offset; // in the file, of its last write
+        size_t           size;
+        pthread_mutex_t  lock;
+        pthread_cond_t   cond;
+    };
+
+    void submit_buffer(size_t size);
+    void wait_buffer(WriteBuffer *buf); // throws if a write failed
+    void wait_write(WriteBuffer *buf);  // records the status of its write
+
+    std::string   file_name;
+    AIOHandler   *aio;
+    const size_t  buf_size;
+    int           fd;
+    WriteBuffer   bufs[NUM_STAGE_MEM];
+    int           cur_buf;
+    size_t        cur_len;
+    uint64_t      file_offset; // of cur_buf
+    bool          closed;
+    int           write_status; // of the first failed write, 0 while all succeeded
+};
+
 bool write_kv_to_mem (SegmentMergeQueue *records, char *src,
-                      int32_t len, int32_t &total_write);
+                      int32_t len, int32_t &total_write, bool write_eof = true);
 
-bool write_kv_to_file(SegmentMergeQueue *records, const char *file_name, int32_t &total_write);
+// codec != NULL writes a block compressed file (offsets in 'index' are of the uncompressed data)
+// aio != NULL writes the file through AioFileOutStream
+bool write_kv_to_file(SegmentMergeQueue *records, const char *file_name, int64_t &total_write, SpillKeyIndex *index = NULL,
+                      DecompressorWrapper *codec = NULL, AIOHandler *aio = NULL);
 
 void write_kv_to_disk(RawKeyValueIterator *records, const char *file_name);
 
@@ -235,7 +449,13 @@ void merge_lpq_to_aio_file(reduce_task* task, SegmentMergeQueue *records, const
 class SuperSegment : public Segment
 {
 public:
-	SuperSegment (reduce_task *_task, const std::string &_path);
+	// codec != NULL for a file written block compressed by write_kv_to_file
+	SuperSegment (reduce_task *_task, const std::string &_path, DecompressorWrapper *codec = NULL);
+
+	// reads only the records of the key range [lower_key, upper_key) - NULL for unbounded -
+	// starting at start_offset; the file is left in place for the other ranges
+	SuperSegment (reduce_task *_task, const std::string &_path, int64_t start_offset,
+	              const std::string *lower_key, const std::string *upper_key, DecompressorWrapper *codec = NULL);
     /* SuperSegment (const std::string &path); */
     ~SuperSegment();
 
@@ -252,6 +472,7 @@ public:
     virtual bool switch_mem() {log(lsERROR, "shouldn't reach here"); throw new UdaException("shouldn't reach here"); return true;}
 
     virtual void close() {return this->Segment::close();}
+    virtual bool next_in_place();
 //    virtual void send_request() {} // nothing to do in derived class
     virtual void send_request() {log(lsERROR, "shouldn't reach here"); throw new UdaException("shouldn't reach here");}
     virtual reduce_task *get_task() {return task;}
@@ -260,7 +481,27 @@ public:
 
     FILE        *file;
     FileStream  *file_stream;
+    InStream    *in_stream; // file_stream, or the decompressing stream over it
     std::string  path;
+
+private:
+    void open_file(DecompressorWrapper *codec);
+    bool map_file();
+    int  readKV();
+    int  readMappedKV();
+
+    bool         remove_on_close;
+    bool         has_lower_key;
+    bool         has_upper_key;
+    std::string  lower_key;
+    std::string  upper_key;
+
+    // uncompressed files are read through a sequential mmap of the whole file,
+    // with key and value pointing into the mapping
+    char        *map_addr; // NULL when reading through in_stream
+    size_t       map_len;
+    size_t       map_pos;
+    size_t       map_released; // pages below this offset were already dropped
 };
 
 #if LCOV_HYBRID_MERGE_DEAD_CODE
@@ -35,7 +35,6 @@
 #include <malloc.h>
 #include <ctime>
 #include <assert.h>
-#include <math.h> //for sqrt
 #include <algorithm>    // std::min
 
 #include "reducer.h"
@@ -43,6 +42,9 @@
 #include "C2JNexus.h"
 #include "../DataNet/RDMAClient.h"
 #include "CompareFunc.h"
+#include "MergePlanner.h"
+#include "NativeCombiner.h"
+#include "RecordIndex.h"
 #include "LzoDecompressor.h"
 #include "SnappyDecompressor.h"
 #include <UdaUtil.h>
@@ -96,9 +98,27 @@ void handle_init_msg(hadoop_cmd_t *hadoop_cmd)
 	int minRdmaBuffer = atoi(hadoop_cmd->params[5]); // java passes it in Bytes
 	long shuffleMemorySize = atol(hadoop_cmd->params[9]);
 
+	string cmp_lib = UdaBridge_invoke_getConfData_callback("mapred.rdma.native.comparator.lib", "");
+	string cmp_spec = UdaBridge_invoke_getConfData_callback("mapred.rdma.native.comparator.spec", "");
+	if (!cmp_lib.empty()) {
+		load_compare_func(hadoop_cmd->params[6], cmp_lib.c_str(),
+				UdaBridge_invoke_getConfData_callback("mapred.rdma.native.comparator.symbol", "uda_key_compare").c_str());
+	}
+	else if (!cmp_spec.empty()) {
+		set_composite_compare_func(hadoop_cmd->params[6], cmp_spec.c_str());
+	}
+	select_byte_diff_func(UdaBridge_invoke_getConfData_callback("mapred.rdma.compare.kernel", "auto").c_str());
 	g_cmp_func = get_compare_func(hadoop_cmd->params[6]); // set compare func using Java's key type name
+	g_prefix_func = get_prefix_func(hadoop_cmd->params[6]);
+	g_key_compare_kind = get_key_compare_kind(hadoop_cmd->params[6]); // for merge heaps with the compare func inlined
+	g_merge_heap_type = get_merge_heap_type(UdaBridge_invoke_getConfData_callback("mapred.rdma.merge.heap", "heap").c_str());
+	string java_combiner = UdaBridge_invoke_getConfData_callback("mapreduce.combine.class", "");
+	if (java_combiner.empty()) java_combiner = UdaBridge_invoke_getConfData_callback("mapred.combiner.class", "");
+	g_combiner = get_native_combiner(UdaBridge_invoke_getConfData_callback("mapred.rdma.native.combiner", "").c_str(), java_combiner.c_str());
 	g_task->comp_alg = getCompAlg(hadoop_cmd->params[7]);
 	g_task->comp_block_size = atoi(hadoop_cmd->params[8]);
+	g_task->shuffle_memory_size = shuffleMemorySize;
+	g_task->max_rdma_buffer_size = maxRdmaBufferSize;
 
 	g_task->init(); // just initialization and calculation without starting a thread
 
@@ -271,19 +291,15 @@ void reduce_task::init()
              "Total Map is %d", 
              this->num_maps);
     
-    int num_lpqs;
-    if (this->lpq_size > 0) {
-    	num_lpqs = (this->num_maps / this->lpq_size);
-    	// if more than one segment left then additional lpq added
-    	// if only one segment left then the first will be larger
-    	if ((this->num_maps % this->lpq_size) > 1)
-    		num_lpqs++;
-    } else {
-        num_lpqs = (int) sqrt(this->num_maps);
-    }
+    int spills_per_disk = ::atoi(UdaBridge_invoke_getConfData_callback ("mapred.rdma.merge.spills.per.disk", STR(DEFAULT_SPILLS_PER_DISK)).c_str());
+    // the LPQs that the MergeManager may hold at once, with those that are merged concurrently
+    int num_parallel_lpqs = MergeManager::get_num_parallel_lpqs(MergeManager::get_num_lpq_merge_threads());
+    MergePlan plan = plan_merge(this->num_maps, this->lpq_size, this->shuffle_memory_size, this->max_rdma_buffer_size,
+    		num_parallel_lpqs, this->local_dirs.size(), spills_per_disk);
+    if (merging_sm.online == 2) plan.log_plan(this->num_maps);
 
     /* Initialize a merge manager thread */
-    this->merge_man = new MergeManager(1, merging_sm.online, this, num_lpqs);
+    this->merge_man = new MergeManager(1, merging_sm.online, this, plan.num_lpqs, plan.spill_fan_in);
     this->the_merging_sm = &merging_sm;
 
 }
@@ -335,6 +351,9 @@ void final_cleanup()
 
 	log(lsINFO, "-------------- STOPING PROCESS ---------");
     /* free map output pool */
+	for (int i = 0; i < merging_sm.mop_pool.num * 2; ++i) {
+		delete merging_sm.mop_pool.desc_arr[i].rec_index;
+	}
 	delete [] merging_sm.mop_pool.desc_arr;
 	delete [] merging_sm.mop_pool.pair_desc_arr;
     pthread_mutex_destroy(&merging_sm.mop_pool.lock);
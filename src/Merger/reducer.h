@@ -89,6 +89,8 @@ typedef struct reduce_task {
     int           total_first_return;
     int			  lpq_size;
     int			  buffer_size;
+    int64_t		  shuffle_memory_size; // for planning the merge
+    int			  max_rdma_buffer_size; // as configured, before fitting to shuffle_memory_size
     std::vector<std::string>   local_dirs; // local dirs will serve for lpq temp files
 
     /*for compression*/
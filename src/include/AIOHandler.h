@@ -81,11 +81,17 @@ public:
 	 * @param long sizeToRead The size to read from filename
 	 * @param void* arg The argument which will be delivered to callback when it will be invoked
 	 * @param void* callback the callback function which will be executed when event will notified by aio context that the submitted request was finished.
+	 * the callback's status is 0 on success, -errno on error, or the number of bytes that were not read
+	 * when the read is short by more than the alignment at EOF explains.
 	 * */
 	int prepare_read(int fd, uint64_t fileOffset, size_t sizeToRead, char* dstBuffer, void* callback_arg /*, bool create_callback_thread=false*/ );
 
 
-	// TODO:
+	/* prepare aio write request that will be submitted on next submit() call.
+	 * fileOffset, sizeToWrite and srcBuffer must be aligned to AIO_ALIGNMENT.
+	 * the completion callback will be invoked with callback_arg and a status of 0 when all
+	 * was written, -errno on error, or the number of bytes that were not written
+	 * */
 	int prepare_write(int fd, uint64_t fileOffset, size_t sizeToWrite, char* srcBuffer, void* callback_arg);
 
 	/* submits prepared aio operations
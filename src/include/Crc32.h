@@ -0,0 +1,42 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+#ifndef UDA_CRC32_H
+#define UDA_CRC32_H 1
+
+#include <stdint.h>
+
+/*
+ * CRC-32 of zlib and java.util.zip.CRC32 (reflected polynomial 0xEDB88320), the checksum that
+ * Hadoop's IFileOutputStream appends to each map output partition.
+ * crc is the CRC of the preceding data (0 for none), as with zlib's crc32();
+ * throws UdaException for a negative len.
+ */
+uint32_t crc32_update(uint32_t crc, const char *buf, int64_t len);
+
+#endif
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ * End:
+ *
+ * vim: ts=4 sw=4 hlsearch cindent expandtab 
+ */
@@ -119,6 +119,10 @@ public:
     char*    getData()    {return this->buf;}
     uint32_t  getPosition(){return this->pos;}
     uint32_t  getLength()  {return this->count;}
+    // direct access for parsers that decode in place (see StreamUtility::decodeKVHeader)
+    char*    getCurrent()  {return this->buf + this->pos;}
+    size_t   getAvailable(){return this->count - this->pos;}
+    void     advance(size_t nbytes) {this->pos += nbytes;} // nbytes <= getAvailable()
 };
 
 /**********************************************
@@ -142,7 +146,60 @@ public:
                                 int &idx, int *br);
     static bool deserializeString(std::string &t, InStream &stream);
     static int  getVIntSize(int64_t );
-    static int 	decodeVIntSize(int byteValue);
+
+    // Parse the first byte of a vint/vlong to determine the number of bytes
+    // byteValue: value of the first byte of the vint/vlong
+    // return the total number of bytes (1 to 9)
+    static int 	decodeVIntSize(int byteValue) { // inline for the key compare funcs
+        if (byteValue >= -112)
+            return 1;
+        else if (byteValue < -120)
+            return -119 - byteValue;
+        else
+            return -111 - byteValue;
+    }
+
+    // WritableUtils.readVLong() from memory: returns the encoded size, or 0 when
+    // fewer bytes than that are available
+    static inline int decodeVLong(const char *p, size_t avail, int64_t &ret) {
+        if (avail == 0) return 0;
+        int8_t first = (int8_t)p[0];
+        if (first >= -112) {
+            ret = first;
+            return 1;
+        }
+        int size = decodeVIntSize(first);
+        if ((size_t)size > avail) return 0;
+        uint64_t v = 0;
+        for (int i = 1; i < size; ++i) {
+            v = (v << 8) | (uint8_t)p[i];
+        }
+        ret = (first < -120) ? ~(int64_t)v : (int64_t)v;
+        return size;
+    }
+
+    // decodes the <key len><val len> VInt header of a KV record in one step.
+    // returns the header size, or 0 when avail does not hold the whole header
+    static inline int decodeKVHeader(const char *p, size_t avail, int32_t &key_len, int32_t &val_len,
+                                     int32_t &kbytes, int32_t &vbytes) {
+        // common case: both lengths fit in a single byte
+        if (avail >= 2 && (int8_t)p[0] >= -112 && (int8_t)p[1] >= -112) {
+            key_len = (int8_t)p[0];
+            val_len = (int8_t)p[1];
+            kbytes = vbytes = 1;
+            return 2;
+        }
+        int64_t k, v;
+        int kb = decodeVLong(p, avail, k);
+        if (!kb) return 0;
+        int vb = decodeVLong(p + kb, avail - kb, v);
+        if (!vb) return 0;
+        key_len = (int32_t)k;
+        val_len = (int32_t)v;
+        kbytes = kb;
+        vbytes = vb;
+        return kb + vb;
+    }
 
 };
 
@@ -82,6 +82,7 @@ public:
 
         popped_value=m_queue.front();
         m_queue.pop();
+        return true;
     }
 
     /** pop that might block in case the queue is currently empty */
@@ -0,0 +1,66 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+import java.io.BufferedReader;
+import java.io.FileReader;
+
+import org.apache.hadoop.io.WritableComparable;
+import org.apache.hadoop.io.WritableComparator;
+
+/**
+ * Replays the key pairs dumped by CompareFunc_test through hadoop's raw
+ * comparators and checks that they agree with the native compare functions.
+ * usage: java -cp <hadoop jars>:. CompareFuncCheck <dump file>
+ */
+public class CompareFuncCheck {
+
+	private static byte[] fromHex(String hex) {
+		byte[] bytes = new byte[hex.length() / 2];
+		for (int i = 0; i < bytes.length; i++) {
+			bytes[i] = (byte) Integer.parseInt(hex.substring(2 * i, 2 * i + 2), 16);
+		}
+		return bytes;
+	}
+
+	public static void main(String[] args) throws Exception {
+		BufferedReader in = new BufferedReader(new FileReader(args[0]));
+		long lines = 0, errors = 0;
+		String line;
+		while ((line = in.readLine()) != null) {
+			String[] f = line.split(" ");
+			WritableComparator cmp = WritableComparator.get(
+					Class.forName(f[0]).asSubclass(WritableComparable.class));
+			byte[] k1 = fromHex(f[1]), k2 = fromHex(f[2]);
+			int res = Integer.signum(cmp.compare(k1, 0, k1.length, k2, 0, k2.length));
+			if (res != Integer.parseInt(f[3])) {
+				if (errors++ < 20) {
+					System.out.println("ERROR: " + line + " java=" + res);
+				}
+			}
+			lines++;
+		}
+		in.close();
+
+		if (errors > 0) {
+			System.out.println("FAILED: " + errors + " of " + lines + " pairs differ");
+			System.exit(1);
+		}
+		System.out.println("PASSED: " + lines + " pairs");
+	}
+}
@@ -0,0 +1,115 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+/*
+ * Microbenchmark of the byte compare kernels of CompareFunc.cc: compares pairs
+ * of keys of a given length that share a given prefix and reports millions of
+ * comparisons per second for each kernel the CPU supports.
+ * Before timing, every kernel is checked to return the sign of memcmp.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <vector>
+#include "CompareFunc.h"
+
+void UdaBridge_invoke_logToJava_callback(const char* log_message, int severity) {}
+
+static const char *KERNELS[] = {"scalar", "sse42", "avx2", NULL}; // scalar is memcmp
+static const int NUM_PAIRS = 1024;
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int sign(int v) { return (v > 0) - (v < 0); }
+
+// pairs of keys with the first 'shared' bytes equal and a difference right after (if any)
+static void make_keys(std::vector<char> &keys1, std::vector<char> &keys2, int key_len, int shared)
+{
+	keys1.resize((size_t)NUM_PAIRS * key_len);
+	keys2.resize((size_t)NUM_PAIRS * key_len);
+	for (size_t i = 0; i < keys1.size(); i++) {
+		keys1[i] = keys2[i] = (char)rand();
+	}
+	if (shared < key_len) {
+		for (int p = 0; p < NUM_PAIRS; p++) {
+			char *c = &keys2[(size_t)p * key_len + shared];
+			*c = (char)(*c + 1 + rand() % 255);
+		}
+	}
+}
+
+static bool verify(byte_diff_func func, const char *name)
+{
+	for (int i = 0; i < 100000; i++) {
+		char k1[300], k2[300];
+		int len = 16 + rand() % 280;
+		int diff = rand() % (len + 1);
+		for (int j = 0; j < len; j++) k1[j] = k2[j] = (char)rand();
+		if (diff < len) k2[diff] = (char)rand();
+		if (sign(func(k1, k2, len)) != sign(memcmp(k1, k2, len))) {
+			printf("ERROR: %s differs from memcmp (len=%d, diff at %d)\n", name, len, diff);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	long total_cmp = (argc > 1) ? atol(argv[1]) : 20000000;
+	const int key_lens[] = {16, 32, 64, 128, 256, 1024};
+	srand(1234);
+
+	printf("%-8s %8s %8s %10s\n", "kernel", "key_len", "shared", "Mcmp/sec");
+	for (size_t l = 0; l < sizeof(key_lens) / sizeof(key_lens[0]); l++) {
+		int key_len = key_lens[l];
+		const int shared_lens[] = {0, key_len / 2, key_len - 1, key_len};
+
+		for (size_t s = 0; s < sizeof(shared_lens) / sizeof(shared_lens[0]); s++) {
+			std::vector<char> keys1, keys2;
+			make_keys(keys1, keys2, key_len, shared_lens[s]);
+
+			for (const char **k = KERNELS; *k; k++) {
+				byte_diff_func func = get_byte_diff_func(*k);
+				if (!func) {
+					if (l == 0 && s == 0) printf("%-8s not supported\n", *k);
+					continue;
+				}
+				if (l == 0 && s == 0 && !verify(func, *k)) return 1;
+
+				volatile int sink = 0;
+				double start = now();
+				for (long i = 0; i < total_cmp; i++) {
+					size_t off = (size_t)(i % NUM_PAIRS) * key_len;
+					sink += func(&keys1[off], &keys2[off], key_len);
+				}
+				double secs = now() - start;
+				printf("%-8s %8d %8d %10.1f\n", *k, key_len, shared_lens[s], total_cmp / secs / 1e6);
+			}
+		}
+	}
+	return 0;
+}
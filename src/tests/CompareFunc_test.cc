@@ -0,0 +1,273 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+/*
+ * Test of the numeric compare functions of CompareFunc.cc: compares random
+ * serialized keys (plus the corner cases: +-0, +-Infinity, NaNs, extremes) with
+ * the compare func and the prefix func, against a port of Java's compareTo.
+ *
+ * Also checks a composite key compare func ("int asc, text desc") against its definition,
+ * on keys cut within a field too (build with -fsanitize=address to catch a read past them).
+ *
+ * With a file argument, the pairs and the expected result are also dumped for
+ * CompareFuncCheck.java, which replays them through hadoop's WritableComparator.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "CompareFunc.h"
+
+void UdaBridge_invoke_logToJava_callback(const char* log_message, int severity) {}
+
+static FILE *g_dump = NULL;
+static long g_errors = 0;
+
+// Java's Double.compare() / Float.compare()
+template <typename F, typename I>
+static int java_float_compare(F f1, F f2)
+{
+	if (f1 < f2) return -1;
+	if (f1 > f2) return 1;
+	I bits1, bits2;
+	if (isnan(f1)) f1 = NAN; // doubleToLongBits
+	if (isnan(f2)) f2 = NAN;
+	memcpy(&bits1, &f1, sizeof(bits1));
+	memcpy(&bits2, &f2, sizeof(bits2));
+	return (bits1 == bits2) ? 0 : ((bits1 < bits2) ? -1 : 1);
+}
+
+static int sign(int64_t v) { return (v > 0) - (v < 0); }
+
+static std::string serialize_double(double d)
+{
+	uint64_t bits;
+	if (isnan(d)) d = NAN; // DataOutput.writeDouble() uses doubleToLongBits
+	memcpy(&bits, &d, sizeof(bits));
+	bits = htobe64(bits);
+	return std::string((char*)&bits, sizeof(bits));
+}
+
+static std::string serialize_float(float f)
+{
+	uint32_t bits;
+	if (isnan(f)) f = NAN;
+	memcpy(&bits, &f, sizeof(bits));
+	bits = htobe32(bits);
+	return std::string((char*)&bits, sizeof(bits));
+}
+
+static std::string serialize_int(int32_t v)
+{
+	uint32_t bits = htobe32((uint32_t)v);
+	return std::string((char*)&bits, sizeof(bits));
+}
+
+// WritableUtils.writeVLong()
+static std::string serialize_vlong(int64_t v)
+{
+	std::string out;
+	if (v >= -112 && v <= 127) {
+		out += (char)v;
+		return out;
+	}
+	int len = -112;
+	if (v < 0) {
+		v = ~v;
+		len = -120;
+	}
+	for (int64_t tmp = v; tmp != 0; tmp >>= 8) len--;
+	out += (char)len;
+	len = (len < -120) ? -(len + 120) : -(len + 112);
+	for (int idx = len; idx != 0; idx--) {
+		out += (char)((v >> ((idx - 1) * 8)) & 0xFF);
+	}
+	return out;
+}
+
+static void dump(const char *java_type, const std::string &k1, const std::string &k2, int expected)
+{
+	if (!g_dump) return;
+	fprintf(g_dump, "%s ", java_type);
+	for (size_t i = 0; i < k1.size(); i++) fprintf(g_dump, "%02x", (uint8_t)k1[i]);
+	fprintf(g_dump, " ");
+	for (size_t i = 0; i < k2.size(); i++) fprintf(g_dump, "%02x", (uint8_t)k2[i]);
+	fprintf(g_dump, " %d\n", expected);
+}
+
+static void check(const char *java_type, const std::string &k1, const std::string &k2, int expected, bool java_check = true)
+{
+	hadoop_cmp_func cmp = get_compare_func(java_type);
+	hadoop_prefix_func prefix = get_prefix_func(java_type);
+	char *p1 = (char*)k1.data(), *p2 = (char*)k2.data();
+
+	int res = sign(cmp(p1, k1.size(), p2, k2.size()));
+	uint64_t pre1 = prefix(p1, k1.size()), pre2 = prefix(p2, k2.size());
+	int pre_res = (pre1 < pre2) ? -1 : (pre1 > pre2);
+
+	if (res != expected || (pre_res != 0 && pre_res != expected)) {
+		if (g_errors++ < 20)
+			printf("ERROR: %s: compare=%d prefix=%d expected=%d\n", java_type, res, pre_res, expected);
+	}
+	if (java_check) dump(java_type, k1, k2, expected);
+}
+
+static double random_double(const std::vector<double> &specials)
+{
+	if (rand() % 4 == 0) return specials[rand() % specials.size()];
+	uint64_t bits = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ rand();
+	double d;
+	memcpy(&d, &bits, sizeof(d));
+	return (rand() % 2) ? d : (rand() % 2000 - 1000) / 7.0;
+}
+
+static int64_t random_long()
+{
+	int64_t v = ((int64_t)rand() << 33) ^ ((int64_t)rand() << 2) ^ rand();
+	switch (rand() % 4) {
+	case 0: return v;
+	case 1: return -v;
+	case 2: return v >> (rand() % 63); // any VInt size
+	default: return (rand() % 512) - 256; // around the single byte encoding
+	}
+}
+
+// <int><Text> key of the composite key check
+static std::string serialize_composite(int32_t v, const std::string &text)
+{
+	return serialize_int(v) + serialize_vlong(text.size()) + text;
+}
+
+static std::string random_text()
+{
+	std::string text;
+	int len = rand() % 20;
+	for (int i = 0; i < len; i++) text += (char)('a' + rand() % 3); // many common prefixes
+	return text;
+}
+
+static void test_composite(int iterations)
+{
+	set_composite_compare_func("test.CompositeKey", "int asc, text desc");
+	for (int i = 0; i < iterations; i++) {
+		int32_t v1 = (rand() % 5) - 2, v2 = (rand() % 5) - 2;
+		std::string t1 = random_text(), t2 = random_text();
+		int expected = (v1 != v2) ? ((v1 < v2) ? -1 : 1) : -sign(t1.compare(t2));
+		check("test.CompositeKey", serialize_composite(v1, t1), serialize_composite(v2, t2), expected, false);
+	}
+
+	// keys cut within a field: ordered by the fields before it, then by what is left of them
+	hadoop_cmp_func cmp = get_compare_func("test.CompositeKey");
+	hadoop_prefix_func prefix = get_prefix_func("test.CompositeKey");
+	for (int i = 0; i < iterations; i++) {
+		int32_t v1 = (rand() % 3) - 1, v2 = (rand() % 3) - 1;
+		std::string k1 = serialize_composite(v1, random_text() + "x");
+		std::string k2 = serialize_composite(v2, random_text());
+		k1.resize(rand() % k1.size()); // always cut
+		int rest1 = (int)k1.size() - 4, rest2 = (int)k2.size() - 4;
+		int expected = (rest1 >= 0 && v1 != v2) ? ((v1 < v2) ? -1 : 1) : sign(rest1 - rest2);
+
+		// exact size buffers, so that a read past a key is caught
+		char *p1 = (char*)malloc(k1.size()), *p2 = (char*)malloc(k2.size());
+		memcpy(p1, k1.data(), k1.size());
+		memcpy(p2, k2.data(), k2.size());
+		int res = sign(cmp(p1, k1.size(), p2, k2.size()));
+		int rev = sign(cmp(p2, k2.size(), p1, k1.size()));
+		prefix(p1, k1.size());
+		if (res != expected || rev != -expected) {
+			if (g_errors++ < 20)
+				printf("ERROR: cut composite key of %d bytes: compare=%d reverse=%d expected=%d\n", (int)k1.size(), res, rev, expected);
+		}
+		free(p1);
+		free(p2);
+	}
+
+	// the fields are one per process
+	set_composite_compare_func("test.OtherCompositeKey", "int, text desc");
+	try {
+		set_composite_compare_func("test.OtherCompositeKey", "int desc, text desc");
+		printf("ERROR: a second composite key spec was accepted\n");
+		g_errors++;
+	}
+	catch (UdaException *ex) {
+		delete ex;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const int iterations = 200000;
+	if (argc > 1) {
+		g_dump = fopen(argv[1], "w");
+		if (!g_dump) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+	srand(1234);
+
+	std::vector<double> specials;
+	specials.push_back(0.0);
+	specials.push_back(-0.0);
+	specials.push_back(INFINITY);
+	specials.push_back(-INFINITY);
+	specials.push_back(NAN);
+	specials.push_back(-NAN);
+	specials.push_back(1.0);
+	specials.push_back(-1.0);
+	specials.push_back(4.9e-324);  // Double.MIN_VALUE
+	specials.push_back(-4.9e-324);
+	specials.push_back(1.7976931348623157e308);
+	specials.push_back(-1.7976931348623157e308);
+
+	for (int i = 0; i < iterations; i++) {
+		double d1 = random_double(specials), d2 = random_double(specials);
+		check("org.apache.hadoop.io.DoubleWritable", serialize_double(d1), serialize_double(d2),
+				java_float_compare<double, int64_t>(d1, d2));
+
+		float f1 = (float)random_double(specials), f2 = (float)random_double(specials);
+		check("org.apache.hadoop.io.FloatWritable", serialize_float(f1), serialize_float(f2),
+				java_float_compare<float, int32_t>(f1, f2));
+
+		int64_t l1 = random_long(), l2 = random_long();
+		check("org.apache.hadoop.io.VLongWritable", serialize_vlong(l1), serialize_vlong(l2), sign((l1 > l2) - (l1 < l2)));
+
+		int32_t v1 = (int32_t)l1, v2 = (int32_t)l2;
+		check("org.apache.hadoop.io.VIntWritable", serialize_vlong(v1), serialize_vlong(v2), sign((v1 > v2) - (v1 < v2)));
+
+		// ID is abstract in Java, hence no WritableComparator to check with; ids are never negative
+		int32_t id1 = rand() % 1000, id2 = rand() % 1000;
+		check("org.apache.hadoop.mapred.ID", serialize_int(id1), serialize_int(id2), sign(id1 - id2), false);
+	}
+
+	if (g_dump) fclose(g_dump);
+
+	test_composite(iterations);
+
+	if (g_errors) {
+		printf("FAILED: %ld errors\n", g_errors);
+		return 1;
+	}
+	printf("PASSED: %d iterations\n", iterations);
+	return 0;
+}
@@ -0,0 +1,329 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+/*
+ * Benchmark of the MOF supplier's DataEngine: replays the shuffle requests of
+ * R reducers for the partitions of M local map output files (IFile records,
+ * written by the benchmark), chunk after chunk as reducers do, and reports the
+ * throughput.  The RDMA send is replaced by releasing the chunk, so the engine
+ * threads, their readers and the disks are what is measured.  Every byte of a
+ * MOF depends on the MOF and on its offset in it, and every chunk is checked
+ * against them before it is released, so that a chunk sent from the wrong file,
+ * offset or place in its buffer fails the run.
+ *
+ * The read mode is the supplier's reader: "aio" (O_DIRECT libaio) or "blocked"
+ * (pread thread pools per disk).  With "cold" the map outputs are dropped from
+ * the page cache before the run, with "hot" they are read into it.
+ *
+ * usage: dataengine_bench <dir> <maps> <reducers> <partition KB> <chunk KB> <engine threads> [numa] [aio|blocked] [hot|cold]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <endian.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "IOUtility.h"
+#include "MOFServlet.h"
+#include "Crc32.h"
+
+#define RECORD_LEN  (100) // 1 byte vint lengths + 10 byte key + 88 byte value
+#define KEY_LEN     (10)
+
+static supplier_state_t g_state;
+static std::string g_dir;
+static int g_num_reducers;
+static int64_t g_part_len;
+static const char *g_engine_threads = "1";
+static const char *g_engine_numa = "0";
+static const char *g_read_mode = "aio";
+
+static pthread_mutex_t g_done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_done_cond = PTHREAD_COND_INITIALIZER;
+static int64_t g_bytes = 0;
+static int64_t g_chunks = 0;
+static int g_open_partitions = 0;
+static int64_t g_bad_chunks = 0;
+
+//------------------------------------------------------------------------------
+// the parts of the JNI bridge and of the RDMA server that the engine uses
+
+void UdaBridge_invoke_logToJava_callback(const char* log_message, int severity) {}
+JNIEnv *UdaBridge_attachNativeThread() { return NULL; }
+void UdaBridge_detachNativeThread() {}
+void UdaBridge_exceptionInNativeThread(JNIEnv *env, UdaException *ex) { fprintf(stderr, "exception in native thread\n"); exit(1); }
+
+std::string UdaBridge_invoke_getConfData_callback(const char* paramName, const char* defaultValue) {
+	if (!strcmp(paramName, "mapred.rdma.supplier.engine.threads")) return g_engine_threads;
+	if (!strcmp(paramName, "mapred.rdma.supplier.engine.numa")) return g_engine_numa;
+	if (!strcmp(paramName, "mapred.rdma.supplier.read.mode")) return g_read_mode;
+	if (!strcmp(paramName, "mapred.local.dir")) return g_dir;
+	return defaultValue;
+}
+
+static std::string mof_path(const char *map_id) {
+	return g_dir + "/" + map_id + ".out";
+}
+
+// the byte at offset off of the MOF of map m: IFile records of position dependent bytes
+static inline char mof_byte(int m, int64_t off) {
+	int64_t pos = off % g_part_len;
+	if (pos >= g_part_len - 2) return (char)-1; // the EOF marker -1:-1
+	switch (pos % RECORD_LEN) {
+	case 0:  return KEY_LEN;
+	case 1:  return RECORD_LEN - 2 - KEY_LEN;
+	default: return 'a' + (uint32_t)((off + 1) * 2654435761u + m * 40503u) % 26;
+	}
+}
+
+// what the TaskTracker answers from file.out.index
+index_record* UdaBridge_invoke_getPathUda_callback(JNIEnv * jniEnv, const char* job_id, const char* map_id, int reduceId) {
+	index_record *record = new index_record();
+	record->offset = reduceId * g_part_len;
+	record->rawLength = g_part_len;
+	record->partLength = g_part_len;
+	record->path = mof_path(map_id);
+	return record;
+}
+
+OutputServer::OutputServer(int data_port, int mode, int rdma_buf_size, supplier_state_t *state) {
+	this->data_port = data_port;
+	this->rdma = NULL;
+	this->rdma_buf_size = rdma_buf_size;
+	this->state = state;
+	INIT_LIST_HEAD(&this->incoming_req_list);
+	pthread_mutex_init(&this->in_lock, NULL);
+	pthread_mutex_init(&this->out_lock, NULL);
+	pthread_cond_init(&this->in_cond, NULL);
+}
+
+OutputServer::~OutputServer() {
+	pthread_mutex_destroy(&this->in_lock);
+	pthread_mutex_destroy(&this->out_lock);
+	pthread_cond_destroy(&this->in_cond);
+}
+
+void OutputServer::insert_incoming_req(shuffle_req_t *req) {
+	pthread_mutex_lock(&in_lock);
+	list_add_tail(&req->list, &incoming_req_list);
+	pthread_cond_broadcast(&in_cond);
+	pthread_mutex_unlock(&in_lock);
+}
+
+// the chunk was read: "send" it, and let the reducer ask for the next one
+void OutputServer::start_outgoing_req(shuffle_req_t *req, index_record_t* record, chunk_t *chunk, uint64_t length, int offsetAligment) {
+	int64_t next_offset = req->map_offset + length;
+
+	int m;
+	const char *data = chunk->buff + offsetAligment;
+	int64_t offset = record->offset + req->map_offset;
+	bool good = sscanf(req->m_map.c_str(), "attempt_bench_m_%d", &m) == 1;
+	for (uint64_t i = 0; good && i < length; ++i) {
+		good = data[i] == mof_byte(m, offset + i);
+	}
+	g_state.data_mac->release_chunk(chunk);
+
+	// counted before the next chunk is asked for, which another reader thread may complete first
+	pthread_mutex_lock(&g_done_lock);
+	g_bytes += length;
+	g_chunks++;
+	if (!good && g_bad_chunks++ < 10) {
+		printf("ERROR: wrong data in the chunk of %s at offset %lld of reducer %d\n", req->m_map.c_str(), (long long)req->map_offset, req->reduceID);
+	}
+	if (next_offset >= record->partLength && --g_open_partitions == 0) {
+		pthread_cond_broadcast(&g_done_cond);
+	}
+	pthread_mutex_unlock(&g_done_lock);
+
+	if (next_offset < record->partLength) {
+		shuffle_req_t *next = new shuffle_req_t();
+		next->m_jobid = req->m_jobid;
+		next->m_map = req->m_map;
+		next->reduceID = req->reduceID;
+		next->map_offset = next_offset;
+		next->chunk_size = req->chunk_size;
+		next->record = new index_record(*record); // the engine deletes req and its record
+		insert_incoming_req(next);
+	}
+}
+
+//------------------------------------------------------------------------------
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// the MOF of map m: num_reducers partitions of IFile records, each ending with the EOF marker
+static void write_mof(const std::string &path, int m)
+{
+	FILE *f = fopen(path.c_str(), "w");
+	if (!f) {
+		perror(path.c_str());
+		exit(1);
+	}
+	std::vector<char> part(g_part_len);
+	for (int r = 0; r < g_num_reducers; ++r) {
+		for (int64_t i = 0; i < g_part_len; ++i) {
+			part[i] = mof_byte(m, r * g_part_len + i);
+		}
+		fwrite(&part[0], 1, part.size(), f);
+	}
+	fclose(f);
+
+	// and its file.out.index, for the supplier's index cache
+	std::vector<uint64_t> index;
+	for (int r = 0; r < g_num_reducers; ++r) {
+		index.push_back(htobe64(r * g_part_len));
+		index.push_back(htobe64(g_part_len));
+		index.push_back(htobe64(g_part_len));
+	}
+	uint64_t checksum = htobe64(crc32_update(0, (char*)&index[0], index.size() * sizeof(uint64_t)));
+	f = fopen((path + ".index").c_str(), "w");
+	if (!f) {
+		perror(path.c_str());
+		exit(1);
+	}
+	fwrite(&index[0], sizeof(uint64_t), index.size(), f);
+	fwrite(&checksum, sizeof(checksum), 1, f);
+	fclose(f);
+}
+
+// hot: read the whole file into the page cache, cold: drop its pages
+static void set_cache_state(const std::string &path, bool hot)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		perror(path.c_str());
+		exit(1);
+	}
+	if (hot) {
+		char buf[1 << 16];
+		while (::read(fd, buf, sizeof(buf)) > 0);
+	}
+	else {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	}
+	::close(fd);
+}
+
+static void *run_engine(void *)
+{
+	g_state.data_mac->start();
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 7) {
+		printf("usage: %s <dir> <maps> <reducers> <partition KB> <chunk KB> <engine threads> [numa] [aio|blocked] [hot|cold]\n", argv[0]);
+		return 1;
+	}
+	g_dir = argv[1];
+	int num_maps = atoi(argv[2]);
+	g_num_reducers = atoi(argv[3]);
+	int num_records = max(1, (int)((atoll(argv[4]) * 1024 - 2) / RECORD_LEN));
+	g_part_len = (int64_t)num_records * RECORD_LEN + 2;
+	int chunk_size = atoi(argv[5]) * 1024;
+	g_engine_threads = argv[6];
+	if (argc > 7) g_engine_numa = argv[7];
+	if (argc > 8) g_read_mode = argv[8];
+	bool hot = argc > 9 && !strcmp(argv[9], "hot");
+	log_set_threshold(lsWARN);
+
+	char map_id[32];
+	for (int m = 0; m < num_maps; ++m) {
+		snprintf(map_id, sizeof(map_id), "attempt_bench_m_%06d_0", m);
+		write_mof(mof_path(map_id), m);
+	}
+	sync();
+	for (int m = 0; m < num_maps; ++m) {
+		snprintf(map_id, sizeof(map_id), "attempt_bench_m_%06d_0", m);
+		set_cache_state(mof_path(map_id), hot);
+	}
+
+	void *mem;
+	if (posix_memalign(&mem, AIO_ALIGNMENT, (size_t)NETLEV_RDMA_MEM_CHUNKS_NUM * (chunk_size + 2 * AIO_ALIGNMENT))) {
+		printf("failed to allocate the chunks\n");
+		return 1;
+	}
+	struct rlimit fd_rlim;
+	getrlimit(RLIMIT_NOFILE, &fd_rlim);
+
+	g_state.mover = new OutputServer(0, 0, chunk_size, &g_state);
+	g_state.data_mac = new DataEngine(mem, &g_state, NULL, 0, chunk_size, fd_rlim);
+	pthread_t engine_thread;
+	pthread_create(&engine_thread, NULL, run_engine, NULL);
+
+	// all reducers ask for their first chunk of every map output, in random order
+	std::vector<shuffle_req_t*> reqs;
+	for (int r = 0; r < g_num_reducers; ++r) {
+		for (int m = 0; m < num_maps; ++m) {
+			shuffle_req_t *req = new shuffle_req_t();
+			snprintf(map_id, sizeof(map_id), "attempt_bench_m_%06d_0", m);
+			req->m_jobid = "job_bench_0001";
+			req->m_map = map_id;
+			req->reduceID = r;
+			req->map_offset = 0;
+			req->chunk_size = chunk_size;
+			req->record = new index_record(); // empty path: first fetch
+			reqs.push_back(req);
+		}
+	}
+	random_shuffle(reqs.begin(), reqs.end());
+	g_open_partitions = reqs.size();
+
+	double start = now();
+	for (size_t i = 0; i < reqs.size(); ++i) {
+		g_state.mover->insert_incoming_req(reqs[i]);
+	}
+	pthread_mutex_lock(&g_done_lock);
+	while (g_open_partitions > 0) {
+		pthread_cond_wait(&g_done_cond, &g_done_lock);
+	}
+	pthread_mutex_unlock(&g_done_lock);
+	double secs = now() - start;
+
+	printf("engine threads=%s, %s reads, %s cache: %d maps x %d reducers, %lld chunks, %.1f MB in %.3f s: %.1f MB/s, %.0f chunks/s\n",
+			g_engine_threads, g_read_mode, hot ? "hot" : "cold", num_maps, g_num_reducers, (long long)g_chunks, g_bytes / 1e6, secs,
+			g_bytes / 1e6 / secs, g_chunks / secs);
+	if (g_bad_chunks) {
+		printf("ERROR: %lld chunks of wrong data\n", (long long)g_bad_chunks);
+	}
+
+	g_state.data_mac->stop = true;
+	pthread_mutex_lock(&g_state.mover->in_lock);
+	pthread_cond_broadcast(&g_state.mover->in_cond);
+	pthread_mutex_unlock(&g_state.mover->in_lock);
+	pthread_join(engine_thread, NULL);
+
+	for (int m = 0; m < num_maps; ++m) {
+		snprintf(map_id, sizeof(map_id), "attempt_bench_m_%06d_0", m);
+		remove(mof_path(map_id).c_str());
+		remove((mof_path(map_id) + ".index").c_str());
+	}
+	return g_bad_chunks ? 1 : 0;
+}
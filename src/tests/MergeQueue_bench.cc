@@ -0,0 +1,112 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+/*
+ * Microbenchmark of the merge structures of MergeQueue.h: merges N sorted
+ * runs of random keys through PriorityQueue (binary heap) and LoserTree and
+ * reports time and comparisons per record.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <vector>
+#include <algorithm>
+#include "MergeQueue.h"
+
+static uint64_t g_num_cmp = 0;
+
+class BenchSegment {
+public:
+	std::vector<uint64_t> keys;
+	size_t pos;
+
+	BenchSegment() : pos(0) {}
+	uint64_t cur() { return keys[pos]; }
+	bool operator<(BenchSegment &seg) { g_num_cmp++; return cur() < seg.cur(); }
+};
+
+static void resetSegment(void*) {}
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+template <class Heap>
+static void runBench(const char* name, Heap *q, std::vector<BenchSegment> &segs, long total)
+{
+	for (size_t i = 0; i < segs.size(); i++) {
+		segs[i].pos = 0;
+		q->put(&segs[i]);
+	}
+
+	g_num_cmp = 0;
+	uint64_t last = 0;
+	long records = 0;
+	double start = now();
+	while (q->size() > 0) {
+		BenchSegment *s = q->top();
+		if (s->cur() < last) {
+			printf("ERROR: %s returned keys out of order\n", name);
+			exit(1);
+		}
+		last = s->cur();
+		records++;
+		if (++s->pos < s->keys.size())
+			q->adjustTop();
+		else
+			q->pop();
+	}
+	double secs = now() - start;
+
+	if (records != total) {
+		printf("ERROR: %s merged %ld records instead of %ld\n", name, records, total);
+		exit(1);
+	}
+	printf("  %-12s %8.3f sec  %7.2f Mrec/s  %6.2f cmp/rec\n", name, secs, records / secs / 1e6, (double)g_num_cmp / records);
+}
+
+int main(int argc, char *argv[])
+{
+	long total = (argc > 1) ? atol(argv[1]) : 8 * 1024 * 1024; // records per run
+	const int fanins[] = {16, 256, 4096};
+
+	srand(1);
+	for (size_t f = 0; f < sizeof(fanins) / sizeof(fanins[0]); f++) {
+		int n = fanins[f];
+		std::vector<BenchSegment> segs(n);
+		for (int i = 0; i < n; i++) {
+			segs[i].keys.resize(total / n);
+			for (size_t j = 0; j < segs[i].keys.size(); j++)
+				segs[i].keys[j] = ((uint64_t)rand() << 31) ^ rand();
+			std::sort(segs[i].keys.begin(), segs[i].keys.end());
+		}
+		long records = (total / n) * n;
+
+		printf("%d segments, %ld records:\n", n, records);
+		PriorityQueue<BenchSegment*> heap(n, resetSegment);
+		runBench("binary heap", &heap, segs, records);
+		LoserTree<BenchSegment*> tree(n, resetSegment);
+		runBench("loser tree", &tree, segs, records);
+	}
+	return 0;
+}
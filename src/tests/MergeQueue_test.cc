@@ -0,0 +1,145 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+** 
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**  
+** http://www.apache.org/licenses/LICENSE-2.0
+** 
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+** either express or implied. See the License for the specific language 
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+/*
+ * Test of the merge structures of MergeQueue.h: PriorityQueue and LoserTree
+ * must return the same keys in order when segments are put() at any time,
+ * also after others were pop()'ed - as long as at most maxSize are queued.
+ *
+ * Build with -D_GLIBCXX_ASSERTIONS so that a write past a structure's
+ * arrays aborts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "MergeQueue.h"
+
+static long g_errors = 0;
+
+class TestSegment {
+public:
+	std::vector<uint64_t> keys;
+	size_t pos;
+
+	TestSegment() : pos(0) {}
+	uint64_t cur() { return keys[pos]; }
+	bool operator<(TestSegment &seg) { return cur() < seg.cur(); }
+};
+
+static void resetSegment(void*) {}
+
+static void make_segments(std::vector<TestSegment> &segs, int n, int len)
+{
+	segs.assign(n, TestSegment());
+	for (int i = 0; i < n; i++) {
+		segs[i].keys.resize(1 + rand() % len);
+		for (size_t j = 0; j < segs[i].keys.size(); j++)
+			segs[i].keys[j] = rand() % 1000;
+		std::sort(segs[i].keys.begin(), segs[i].keys.end());
+	}
+}
+
+// merges what is queued in q, expecting the keys of expected (sorted) to come out
+template <class Heap>
+static void check_merge(const char *test, Heap *q, std::vector<uint64_t> &expected)
+{
+	std::vector<uint64_t> merged;
+	while (q->size() > 0) {
+		TestSegment *s = q->top();
+		merged.push_back(s->cur());
+		if (++s->pos < s->keys.size())
+			q->adjustTop();
+		else
+			q->pop();
+	}
+	std::sort(expected.begin(), expected.end());
+	if (merged != expected) {
+		printf("ERROR: %s: merged %d keys, expected %d keys in order\n", test, (int)merged.size(), (int)expected.size());
+		g_errors++;
+	}
+}
+
+// a full structure that loses segments and gets new ones all the time, as in an LPQ merge
+template <class Heap>
+static void test_put_after_pop(const char *name, Heap *q, int n)
+{
+	std::vector<TestSegment> segs;
+	make_segments(segs, 4 * n, 20);
+
+	std::vector<uint64_t> expected;
+	size_t next = 0;
+	for (; next < (size_t)n; next++) {
+		q->put(&segs[next]);
+		expected.insert(expected.end(), segs[next].keys.begin(), segs[next].keys.end());
+	}
+
+	std::vector<uint64_t> merged;
+	while (q->size() > 0) {
+		TestSegment *s = q->top();
+		merged.push_back(s->cur());
+		if (++s->pos < s->keys.size()) {
+			q->adjustTop();
+		}
+		else {
+			q->pop();
+			if (next < segs.size()) { // its keys come after the merged ones
+				for (size_t j = 0; j < segs[next].keys.size(); j++)
+					segs[next].keys[j] += merged.back();
+				q->put(&segs[next]);
+				expected.insert(expected.end(), segs[next].keys.begin(), segs[next].keys.end());
+				next++;
+			}
+		}
+	}
+	std::sort(expected.begin(), expected.end());
+	if (merged != expected) {
+		printf("ERROR: %s put after pop (%d segments): wrong merge of %d keys\n", name, n, (int)expected.size());
+		g_errors++;
+	}
+
+	// and once drained, the structure is filled up again
+	make_segments(segs, n, 20);
+	expected.clear();
+	for (int i = 0; i < n; i++) {
+		q->put(&segs[i]);
+		expected.insert(expected.end(), segs[i].keys.begin(), segs[i].keys.end());
+	}
+	check_merge(name, q, expected);
+}
+
+int main(int argc, char *argv[])
+{
+	const int sizes[] = {1, 2, 3, 16, 100};
+	srand(1);
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		PriorityQueue<TestSegment*> heap(sizes[i], resetSegment);
+		test_put_after_pop("binary heap", &heap, sizes[i]);
+		LoserTree<TestSegment*> tree(sizes[i], resetSegment);
+		test_put_after_pop("loser tree", &tree, sizes[i]);
+	}
+
+	if (g_errors) {
+		printf("%ld errors\n", g_errors);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
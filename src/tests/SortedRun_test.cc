@@ -0,0 +1,207 @@
+/*
+** Copyright (C) 2012 Auburn University
+** Copyright (C) 2012 Mellanox Technologies
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at:
+**
+** http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+** either express or implied. See the License for the specific language
+** governing permissions and  limitations under the License.
+**
+**
+*/
+
+/*
+ * Test of SortedRunSegment, the online merge of resident map outputs: the records
+ * of in-memory segments must come out of the sorted run in key order, with the
+ * records of equal keys of a segment in their order in that segment.  The keys
+ * share leading bytes, so the radix sort skips them, and many keys share their
+ * whole prefix, so the compare func orders them.  The sorted run is then inserted
+ * into the MergeQueue that it was taken from, and merged from there, with either
+ * merge structure.
+ *
+ * Build with -D_GLIBCXX_ASSERTIONS so that a write past a structure's
+ * arrays aborts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "reducer.h"
+#include "MergeQueue.h"
+#include "SortedRun.h"
+#include "CompareFunc.h"
+#include "NativeCombiner.h"
+#include "KeySketch.h"
+
+hadoop_cmp_func g_cmp_func; // normally in NetMergerMain.cc
+reduce_task_t *g_task = NULL;
+
+static long g_errors = 0;
+
+//------------------------------------------------------------------------------
+// the parts of the reducer and of the JNI bridge that the segments use
+
+void UdaBridge_invoke_logToJava_callback(const char* log_message, int severity) {}
+JNIEnv *UdaBridge_attachNativeThread() { return NULL; }
+void UdaBridge_detachNativeThread() {}
+void UdaBridge_exceptionInNativeThread(JNIEnv *env, UdaException *ex) { fprintf(stderr, "exception in native thread\n"); exit(1); }
+void free_hadoop_cmd(hadoop_cmd&) {}
+void MergeManager::start_fetch_req(client_part_req*) {}
+void HotKeySketch::sample(const char*, int, int64_t) {}
+const native_combiner_t *g_combiner = NULL;
+
+//------------------------------------------------------------------------------
+// a map output that is resident in memory: its records in key order
+class MemSegment : public BaseSegment
+{
+public:
+	std::vector<std::string> keys;
+	std::vector<std::string> vals;
+	size_t pos;
+
+	MemSegment() : BaseSegment(NULL), pos(0) {}
+
+	virtual int nextKV() {
+		if (pos == keys.size()) {
+			eof = true;
+			return 0;
+		}
+		cur_key_len = keys[pos].size();
+		cur_val_len = vals[pos].size();
+		kbytes = vbytes = 1;
+		set_key((char*)keys[pos].data(), cur_key_len);
+		val.reset((char*)vals[pos].data(), cur_val_len);
+		pos++;
+		return 1;
+	}
+	virtual void send_request() {}
+};
+
+static void resetSegment(void*) {}
+
+static bool key_less(const std::string &a, const std::string &b)
+{
+	return g_cmp_func((char*)a.data(), a.size(), (char*)b.data(), b.size()) < 0;
+}
+
+// a key of the given shape: its leading bytes are shared by all keys of the shape
+static std::string make_key(int shape)
+{
+	static const char bytes[] = {'a', 'b', 'c', '\xff'};
+	std::string key;
+	int len;
+	switch (shape) {
+	case 0: // short keys: few distinct ones, all within the prefix
+		len = 1 + rand() % 3;
+		break;
+	case 1: // the whole prefix is shared: only the compare func orders them
+		key = "sharedpf";
+		len = rand() % 4;
+		break;
+	default: // shared leading bytes, then both the prefix and the rest vary
+		key = "abc";
+		len = rand() % 10;
+		break;
+	}
+	for (int i = 0; i < len; i++)
+		key += bytes[rand() % sizeof(bytes)];
+	return key;
+}
+
+// the value of a record tells its segment and its place in that segment
+static std::string make_val(int seg, int rec)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%04d-%06d", seg, rec);
+	return buf;
+}
+
+static void test_sorted_run(const char *name, MERGE_HEAP_TYPE type, int shape, int n)
+{
+	g_merge_heap_type = type;
+	SegmentMergeQueue *queue = createSegmentMergeQueue(n, NULL, "", resetSegment);
+
+	std::vector<std::string> expected;
+	size_t num_records = 0;
+	for (int i = 0; i < n; i++) {
+		MemSegment *seg = new MemSegment(); // the queue and the sorted run delete their segments
+		int len = 1 + rand() % 50;
+		for (int j = 0; j < len; j++)
+			seg->keys.push_back(make_key(shape));
+		std::stable_sort(seg->keys.begin(), seg->keys.end(), key_less);
+		for (int j = 0; j < len; j++)
+			seg->vals.push_back(make_val(i, j));
+		expected.insert(expected.end(), seg->keys.begin(), seg->keys.end());
+		num_records += len;
+		queue->insert(seg);
+	}
+	std::stable_sort(expected.begin(), expected.end(), key_less);
+
+	// as merge_online
+	SortedRunSegment *run = new SortedRunSegment(NULL, queue, num_records);
+	if (run->num_records() != num_records) {
+		printf("ERROR: %s (%d segments): the sorted run took %d of %d records\n", name, n, (int)run->num_records(), (int)num_records);
+		g_errors++;
+	}
+	queue->insert(run);
+
+	std::vector<std::string> merged;
+	std::map<std::string, std::string> last_val; // of a key and a segment
+	bool in_order = true;
+	while (queue->next()) {
+		std::string key(queue->getKey()->getData(), queue->getKey()->getLength());
+		std::string val(queue->getVal()->getData(), queue->getVal()->getLength());
+		std::string &last = last_val[key + '/' + val.substr(0, 4)];
+		if (val < last)
+			in_order = false; // equal keys of a segment must keep their order
+		last = val;
+		merged.push_back(key);
+	}
+	delete queue;
+
+	if (merged != expected) {
+		printf("ERROR: %s (%d segments): merged %d keys, expected %d keys in order\n", name, n, (int)merged.size(), (int)expected.size());
+		g_errors++;
+	}
+	if (!in_order) {
+		printf("ERROR: %s (%d segments): equal keys of a segment were reordered\n", name, n);
+		g_errors++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const int sizes[] = {2, 3, 16, 100};
+	const char *shapes[] = {"short keys", "shared prefix", "shared leading bytes"};
+	srand(1);
+	g_cmp_func = get_compare_func("org.apache.hadoop.io.LongWritable"); // compares the key bytes
+	g_prefix_func = get_prefix_func("org.apache.hadoop.io.LongWritable");
+	g_key_compare_kind = get_key_compare_kind("org.apache.hadoop.io.LongWritable");
+
+	for (int shape = 0; shape < 3; shape++) {
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			std::string name = std::string("binary heap, ") + shapes[shape];
+			test_sorted_run(name.c_str(), HEAP_BINARY, shape, sizes[i]);
+			name = std::string("loser tree, ") + shapes[shape];
+			test_sorted_run(name.c_str(), HEAP_LOSER_TREE, shape, sizes[i]);
+		}
+	}
+
+	if (g_errors) {
+		printf("%ld errors\n", g_errors);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
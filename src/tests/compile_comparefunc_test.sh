@@ -0,0 +1,24 @@
+#!/bin/bash
+#
+# Copyright (C) 2012 Auburn University
+# Copyright (C) 2012 Mellanox Technologies
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at:
+#  
+# http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+# either express or implied. See the License for the specific language 
+# governing permissions and  limitations under the License.
+#
+#
+g++ -O2 -std=gnu++0x -D_GNU_SOURCE -include pthread.h CompareFunc_test.cc ../Merger/CompareFunc.cc ../CommUtils/IOUtility.cc -o comparefunc_test -I../ -I../include/ -I../Merger/ -lpthread -ldl
+
+# cross-check with hadoop's comparators: ./comparefunc_test pairs.txt && java -cp $(hadoop classpath):. CompareFuncCheck pairs.txt
+if which javac > /dev/null 2>&1 && which hadoop > /dev/null 2>&1; then
+	javac -cp $(hadoop classpath) CompareFuncCheck.java
+fi
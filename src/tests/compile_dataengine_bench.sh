@@ -0,0 +1,22 @@
+#!/bin/bash
+#
+# Copyright (C) 2012 Auburn University
+# Copyright (C) 2012 Mellanox Technologies
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at:
+#  
+# http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+# either express or implied. See the License for the specific language 
+# governing permissions and  limitations under the License.
+#
+#
+g++ -O2 -std=gnu++0x -D_GNU_SOURCE DataEngine_bench.cc ../MOFServer/IndexInfo.cc ../MOFServer/IndexCache.cc ../CommUtils/AIOHandler.cc ../CommUtils/IOUtility.cc ../CommUtils/UdaUtil.cc ../CommUtils/Crc32.cc ../AsyncIO/AbstractReader.cc ../AsyncIO/AsyncReaderManager.cc ../AsyncIO/AsyncReaderThread.cc ../AsyncIO/AioReader.cc -o dataengine_bench -I../ -I../include/ -I../MOFServer/ -I../DataNet/ -I$JAVA_HOME/include -I$JAVA_HOME/include/linux -laio -lpthread -lrt
+# e.g. ./dataengine_bench /data1/tmp 100 200 256 128 4
+# or both readers on page cache hot and cold map outputs:
+# for mode in aio blocked; do for cache in hot cold; do ./dataengine_bench /data1/tmp 100 200 256 128 4 0 $mode $cache; done; done
@@ -0,0 +1,19 @@
+#!/bin/bash
+#
+# Copyright (C) 2012 Auburn University
+# Copyright (C) 2012 Mellanox Technologies
+# 
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at:
+#  
+# http://www.apache.org/licenses/LICENSE-2.0
+# 
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, 
+# either express or implied. See the License for the specific language 
+# governing permissions and  limitations under the License.
+#
+#
+g++ -O2 -g -std=gnu++0x -D_GNU_SOURCE -D_GLIBCXX_ASSERTIONS -include pthread.h SortedRun_test.cc ../Merger/SortedRun.cc ../Merger/StreamRW.cc ../Merger/MergeQueue.cc ../Merger/CompareFunc.cc ../CommUtils/IOUtility.cc ../CommUtils/AIOHandler.cc ../CommUtils/UdaUtil.cc -o sortedrun_test -I../ -I../include/ -I../Merger/ -I$JAVA_HOME/include -I$JAVA_HOME/include/linux -laio -lpthread -lrt -ldl && ./sortedrun_test